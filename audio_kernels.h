@@ -0,0 +1,155 @@
+/*
+ * Audio sample kernels shared by ndi2jack and jack2ndi
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#define AUDIO_KERNELS_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_KERNELS_NEON 1
+#endif
+
+/**
+ * Copy n samples from src to dst and return the largest absolute sample
+ * value seen on the way through. Used to detect silence without a second
+ * pass over the buffer.
+ */
+static inline float copy_abs_max(float *dst, const float *src, uint32_t n){
+  uint32_t i = 0;
+  float peak = 0.0f;
+#if defined(AUDIO_KERNELS_SSE)
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  __m128 v_peak = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4){
+   __m128 v = _mm_loadu_ps(src + i);
+   _mm_storeu_ps(dst + i, v);
+   v_peak = _mm_max_ps(v_peak, _mm_andnot_ps(sign_mask, v)); //clear the sign bit for the absolute value
+  }
+  v_peak = _mm_max_ps(v_peak, _mm_movehl_ps(v_peak, v_peak)); //fold the four lanes into one
+  v_peak = _mm_max_ss(v_peak, _mm_shuffle_ps(v_peak, v_peak, 1));
+  peak = _mm_cvtss_f32(v_peak);
+#elif defined(AUDIO_KERNELS_NEON)
+  float32x4_t v_peak = vdupq_n_f32(0.0f);
+  for (; i + 4 <= n; i += 4){
+   float32x4_t v = vld1q_f32(src + i);
+   vst1q_f32(dst + i, v);
+   v_peak = vmaxq_f32(v_peak, vabsq_f32(v));
+  }
+  float32x2_t v_half = vpmax_f32(vget_low_f32(v_peak), vget_high_f32(v_peak)); //fold the four lanes into one
+  v_half = vpmax_f32(v_half, v_half);
+  peak = vget_lane_f32(v_half, 0);
+#endif
+  for (; i < n; i++){ //scalar tail (and the whole buffer without SIMD)
+   dst[i] = src[i];
+   float sample = fabsf(src[i]);
+   if(sample > peak){
+    peak = sample;
+   }
+  }
+  return peak;
+}
+
+/**
+ * Dot product of two float vectors, used by the FIR filters.
+ */
+static inline float dot_product(const float *a, const float *b, uint32_t n){
+  uint32_t i = 0;
+  float sum = 0.0f;
+#if defined(AUDIO_KERNELS_SSE)
+  __m128 v_sum = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4){
+   v_sum = _mm_add_ps(v_sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  v_sum = _mm_add_ps(v_sum, _mm_movehl_ps(v_sum, v_sum)); //fold the four lanes into one
+  v_sum = _mm_add_ss(v_sum, _mm_shuffle_ps(v_sum, v_sum, 1));
+  sum = _mm_cvtss_f32(v_sum);
+#elif defined(AUDIO_KERNELS_NEON)
+  float32x4_t v_sum = vdupq_n_f32(0.0f);
+  for (; i + 4 <= n; i += 4){
+   v_sum = vmlaq_f32(v_sum, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+  float32x2_t v_half = vadd_f32(vget_low_f32(v_sum), vget_high_f32(v_sum)); //fold the four lanes into one
+  sum = vget_lane_f32(vpadd_f32(v_half, v_half), 0);
+#endif
+  for (; i < n; i++){
+   sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+/**
+ * dst = src * gain, with the gain ramping linearly from gain_start to
+ * gain_end across the n samples so that parameter changes never step.
+ * The last sample lands exactly on gain_end.
+ */
+static inline void gain_ramp(float *dst, const float *src, uint32_t n, float gain_start, float gain_end){
+  uint32_t i = 0;
+  if(n == 0){
+   return;
+  }
+  float step = (gain_end - gain_start) / n;
+#if defined(AUDIO_KERNELS_SSE)
+  __m128 v_gain = _mm_add_ps(_mm_set1_ps(gain_start), _mm_mul_ps(_mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f), _mm_set1_ps(step)));
+  __m128 v_step = _mm_set1_ps(step * 4.0f);
+  for (; i + 4 <= n; i += 4){
+   _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), v_gain));
+   v_gain = _mm_add_ps(v_gain, v_step);
+  }
+#elif defined(AUDIO_KERNELS_NEON)
+  const float lanes[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+  float32x4_t v_gain = vmlaq_n_f32(vdupq_n_f32(gain_start), vld1q_f32(lanes), step);
+  float32x4_t v_step = vdupq_n_f32(step * 4.0f);
+  for (; i + 4 <= n; i += 4){
+   vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), v_gain));
+   v_gain = vaddq_f32(v_gain, v_step);
+  }
+#endif
+  for (; i < n; i++){
+   dst[i] = src[i] * (gain_start + step * (i + 1));
+  }
+  if(gain_start != gain_end){ //no rounding drift on the final sample
+   dst[n - 1] = src[n - 1] * gain_end;
+  }
+}
+
+/**
+ * dst += src * gain with the same linear gain ramp as gain_ramp(), for
+ * summing many sources into one bus.
+ */
+static inline void mix_ramp(float *dst, const float *src, uint32_t n, float gain_start, float gain_end){
+  uint32_t i = 0;
+  if(n == 0){
+   return;
+  }
+  float step = (gain_end - gain_start) / n;
+#if defined(AUDIO_KERNELS_SSE)
+  __m128 v_gain = _mm_add_ps(_mm_set1_ps(gain_start), _mm_mul_ps(_mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f), _mm_set1_ps(step)));
+  __m128 v_step = _mm_set1_ps(step * 4.0f);
+  for (; i + 4 <= n; i += 4){
+   _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), v_gain)));
+   v_gain = _mm_add_ps(v_gain, v_step);
+  }
+#elif defined(AUDIO_KERNELS_NEON)
+  const float lanes[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+  float32x4_t v_gain = vmlaq_n_f32(vdupq_n_f32(gain_start), vld1q_f32(lanes), step);
+  float32x4_t v_step = vdupq_n_f32(step * 4.0f);
+  for (; i + 4 <= n; i += 4){
+   vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), vld1q_f32(src + i), v_gain));
+   v_gain = vaddq_f32(v_gain, v_step);
+  }
+#endif
+  for (; i < n; i++){
+   dst[i] += src[i] * (gain_start + step * (i + 1));
+  }
+}
+
+#endif
@@ -11,5 +11,5 @@ fi
 cp "NDI SDK for Linux"/include/* include/
 cp "NDI SDK for Linux"/lib/aarch64-rpi4-linux-gnueabi/* lib/
 
-g++ -std=c++14 -pthread  -Wl,--allow-shlib-undefined -Wl,--as-needed -Iinclude/ -L lib -o build/ndi2jack ndi2jack.cpp mongoose.c mjson.c -lndi -ldl -ljack
-g++ -std=c++14 -pthread  -Wl,--allow-shlib-undefined -Wl,--as-needed -Iinclude/ -L lib -o build/jack2ndi jack2ndi.cpp -lndi -ldl -ljack
+g++ -std=c++14 -O2 -pthread  -Wl,--allow-shlib-undefined -Wl,--as-needed ${CXXFLAGS} -Iinclude/ -L lib -o build/ndi2jack ndi2jack.cpp mongoose.c mjson.c -lndi -ldl -ljack
+g++ -std=c++14 -O2 -pthread  -Wl,--allow-shlib-undefined -Wl,--as-needed ${CXXFLAGS} -Iinclude/ -L lib -o build/jack2ndi jack2ndi.cpp -lndi -ldl -ljack
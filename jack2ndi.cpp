@@ -17,146 +17,715 @@
 #include <atomic>
 #include <unistd.h>
 #include <fstream> //for reading and writing preset file
-#include <condition_variable>
+#include <semaphore.h>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include <getopt.h>
 
 #include <Processing.NDI.Lib.h>
 #include <jack/jack.h>
+#include "audio_kernels.h"
+#include "resampler.h"
+#include "jack_supervisor.h"
+#include "load_governor.h"
+#include "spsc_queue.h"
+#include "rt_setup.h"
+#include "rt_check.h"
+#include "trace.h"
 
 bool auto_connect_jack_ports = false;
+int stats_interval = 0; //seconds between stats printouts - 0 disables stats
+float silence_threshold = 0.0001f; //-80 dBFS - frames peaking below this count as silent
+int silence_hold_ms = 0; //how long a sender must be silent before dropping to keepalives - 0 disables the gate
+int keepalive_ms = 1000; //interval between keepalive frames while silence gated
+bool clock_audio = false; //let the NDI SDK pace audio sends
+std::atomic<int64_t> jack_utc_offset(0); //offset from the JACK clock to UTC in 100ns units - refreshed by the supervisor
+
+/**
+ * NDI timecodes are UTC in 100ns units. Work out the offset from the JACK
+ * microsecond clock, which needs an open client on JACK1, and keep it up to
+ * date as NTP slews the system clock against it.
+ */
+static void update_utc_offset(void){
+  int64_t utc = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  jack_utc_offset.store((utc - (int64_t)jack_get_time()) * 10, std::memory_order_relaxed);
+}
+int ndi_sample_rate = 0; //sample rate of the NDI stream - 0 sends at the JACK rate
+resampler_quality resample_quality = resampler_quality_medium;
+int num_inputs = 2; //number of JACK input ports
+int split_channels = 0; //split the inputs into streams of this many channels - 0 sends one stream
+int num_workers = 0; //sender threads - 0 picks one per stream up to the number of cores
+rt_setup rt_threads; //CPUs and priorities of the control, NDI and sender threads, from --affinity
 
 static char             *ndi_name;
 static char             *client_name;
+static char             *map_file = NULL; //file describing which inputs feed which NDI stream
 
 //Function Definitions
 int process_callback(jack_nframes_t x, void *p);
 
+struct ndi_stream;
+
+struct send_frame {
+  ndi_stream *stream; //NDI stream the frame belongs to
+  float *p_data; //planar samples, one channel after another
+  jack_nframes_t no_samples;
+  float peak; //largest absolute sample value in the frame
+  jack_time_t usecs; //JACK time of the first sample in the frame
+  int64_t timecode; //NDI timecode of the first sample in the frame (100ns units, UTC)
+};
+
+static const jack_nframes_t max_period = 8192; //largest JACK period - frames are sized for it so period changes never reallocate
 
+/**
+ * Everything in a stream that depends on the JACK sample rate. Built off
+ * the RT thread when the rate changes and swapped in by the sender thread
+ * between frames.
+ */
+struct stream_rate {
+ stream_rate(void): jack_rate(0), send_rate(0), resample(false), out(NULL), stride(0){}
+ ~stream_rate(void){ free(out); }
+  jack_nframes_t jack_rate;
+  int send_rate; //sample rate of the NDI frames
+  bool resample;
+  resampler conv; //converts JACK rate frames to ndi_sample_rate
+  float *out; //planar output of the resampler
+  int stride; //samples per channel in out
+};
+
+struct stream_config {
+  std::string ndi_name;
+  std::vector<int> channels; //JACK input port feeding each NDI channel
+};
+
+/**
+ * One NDI sender fed from a subset of the JACK inputs. process() fills its
+ * frames on the RT thread and one of the sender threads sends them.
+ */
+struct ndi_stream {
+ ndi_stream(const stream_config &config, jack_nframes_t sample_rate, jack_nframes_t frame_capacity, int worker); //constructor
+ ~ndi_stream(void); //destructor
+ public:
+  send_frame* next_frame(void);
+  send_frame* scratch_frame(void){ return &m_scratch; }
+  void send(send_frame *frame);
+  void connection_thread(void);
+  void print_stats(void);
+  void set_jack_rate(jack_nframes_t rate); //not RT safe
+  void set_resample_quality(resampler_quality quality); //not RT safe
+  std::string m_ndi_name;
+  std::vector<int> m_channels; //JACK input port for each NDI channel
+  int num_channels;
+  int m_worker; //sender thread that sends this stream
+  std::atomic<bool> m_listening; //true while at least one NDI receiver is connected
+  std::atomic<int> m_queued; //frames waiting for the sender thread
+  std::atomic<uint64_t> m_frames_dropped; //frames dropped because the sender thread fell behind
+  uint64_t m_drops_reported = 0; //m_frames_dropped when the supervisor last reported it
+  std::atomic<uint64_t> m_copy_us; //total time process() spent copying this stream
+ private:	
+	NDIlib_send_instance_t m_pNDI_send; //create the NDI sender
+  NDIlib_audio_frame_v2_t m_NDI_audio_frame; //create the audio frame for sending
+  jack_nframes_t m_frame_capacity; //samples per channel that each frame can hold
+  static const int frame_pool_size = 4; //frames the RT thread rotates through - must stay above the queue depth + 1
+  send_frame m_frames[frame_pool_size];
+  send_frame m_scratch; //filled while JACK freewheels - never queued, so the pool frames being sent are left alone
+  int m_frame_index = 0; //next pool frame to be filled by process()
+  stream_rate *m_rate; //owned by the sender thread
+  std::atomic<stream_rate*> m_pending_rate; //built for a new JACK rate, taken by the sender thread
+  std::atomic<jack_nframes_t> m_jack_rate; //copies of the latest rates for the stats
+  std::atomic<int> m_send_rate;
+  std::atomic<int> m_quality; //resampler quality new rate state is built with - lowered under load
+  std::mutex m_rate_lock; //rate and quality changes come from JACK's notification thread and the supervisor - one rebuild at a time
+ public:
+  std::atomic<int> m_latency; //samples at the JACK rate the resampler holds back
+ private:
+  stream_rate* make_rate(jack_nframes_t rate);
+  std::chrono::steady_clock::time_point m_last_sound; //last time a frame peaked above the silence threshold
+  std::chrono::steady_clock::time_point m_last_keepalive;
+  std::thread monitor_thread; //polls the NDI connection count off the RT thread
+  std::atomic<uint64_t> m_active_ms; //time spent sending to connected receivers
+  std::atomic<uint64_t> m_idle_ms; //time spent with no receivers connected
+  std::atomic<uint64_t> m_frames_sent;
+  std::atomic<uint64_t> m_frames_gated; //silent frames not sent because of the silence gate
+  std::atomic<uint64_t> m_bytes_gated;
+  std::atomic<uint64_t> m_send_us; //total time spent in NDIlib_send_send_audio_v2
+  std::atomic<uint64_t> m_resample_us; //total time spent resampling
+  std::atomic<bool> m_gated; //true while only keepalive frames are sent
+  std::atomic<uint64_t> m_jitter_count; //send delay relative to the JACK clock, in microseconds
+  std::atomic<uint64_t> m_jitter_sum;
+  std::atomic<uint64_t> m_jitter_sum_sq;
+  std::atomic<uint64_t> m_jitter_max;
+	std::atomic<bool> m_exit;	// Are we ready to exit		
+};
+
+/**
+ * A sender thread and its frame queue. Streams are spread over a small
+ * pool of these so a single process can publish dozens of NDI streams.
+ */
+struct send_worker {
+ send_worker(void); //constructor
+ ~send_worker(void); //destructor
+ public:
+  void queue_wait(void);
+  void process_audio_thread(void);
+  bool queue_push(send_frame* frame); //RT safe - false when the queue is full
+  send_frame* queue_pop_opt(void);
+ private:
+  std::thread audio_thread;
+  spsc_queue<send_frame*, 256> m_queue; //frames from the process callback - more than the streams of one worker can have waiting
+  sem_t m_ready; //posted for every frame pushed, so the worker sleeps without the RT thread taking a lock
+	std::atomic<bool> m_exit;	// Are we ready to exit		
+};
 
 struct send_audio {
- send_audio(const char *c_name="ndi",const char *n_name="NDI_send",bool a_ports=false); //constructor
+ send_audio(const char *c_name, const std::vector<stream_config> &streams, int no_inputs = 2, int no_workers = 1, bool a_ports = false); //constructor
  ~send_audio(void); //destructor 
  public:
   int process(jack_nframes_t nframes);
-  void queue_wait(void);
-  void process_audio_thread(void);
-  void queue_push(jack_default_audio_sample_t** frame);
-  jack_default_audio_sample_t** queue_pop_opt(void);
+  void print_stats(void);
  private:	
-	NDIlib_send_instance_t m_pNDI_send; //create the NDI sender
-  NDIlib_audio_frame_v2_t m_NDI_audio_frame; //create the audio frame for sending
   jack_port_t **in_ports;
-  jack_default_audio_sample_t **in;
+  jack_default_audio_sample_t **in; //JACK input buffers for the current period
   jack_client_t *jack_client;
   jack_nframes_t jack_sample_rate;
-  int num_channels = 2;
+  int num_inputs = 2;
   jack_nframes_t num_frames;
-  std::thread audio_thread;
-  std::size_t m_max_depth = 1;    // How many items we will queue before dropping them
-  std::mutex m_lock;
-  std::condition_variable m_condvar;
-  std::queue<jack_default_audio_sample_t**> m_queue;
+  std::vector<ndi_stream*> m_streams;
+  std::vector<send_worker*> m_workers;
+  std::size_t m_max_depth = 1;    // How many frames per stream we will queue before dropping them
 	std::atomic<bool> m_exit;	// Are we ready to exit		
+  std::string m_client_name; //name JACK gave us, reused when reconnecting so connections match
+  jack_supervisor m_supervisor;
+  std::thread m_supervisor_thread; //reconnects after a JACK restart while the NDI senders keep running
+  void supervise(void);
   static void jack_shutdown(void *arg); //This is called when JACK is shutdown
+  static int sample_rate_callback(jack_nframes_t nframes, void *arg);
+  static int buffer_size_callback(jack_nframes_t nframes, void *arg);
+  static void latency_callback(jack_latency_callback_mode_t mode, void *arg);
+  static void freewheel_callback(int starting, void *arg);
+  std::atomic<bool> m_freewheel; //JACK is running faster than real time - nothing is sent
+  std::atomic<uint64_t> m_freewheel_frames; //processed in the current or last freewheel run
+  std::atomic<uint64_t> m_freewheel_us; //time spent in the process callback for them
+  std::atomic<bool> m_latency_changed; //the supervisor thread asks JACK to recompute the graph latencies
+  load_governor m_governor; //lowers the resampler quality while the server is overloaded
+  void apply_load_level(void);
 };
 
-void send_audio::queue_wait(void){
-  std::unique_lock<std::mutex> lock_queue(m_lock); //lock the queue
-  while (m_queue.empty()){ //wait until there is a new frame
-    m_condvar.wait(lock_queue);
+void send_worker::queue_wait(void){
+  while ((sem_wait(&m_ready) != 0) && (errno == EINTR)){ //wait until there is a new frame or we are told to exit
   }
 }
 
-void send_audio::queue_push(jack_default_audio_sample_t** frame){
-  std::unique_lock<std::mutex> lock_queue(m_lock); //Lock the queue
-  m_queue.push(std::move(frame)); // Queue the frame
-
-  // Drop items that are too old if the queue is not keeping up
-  while ((m_max_depth) && (m_queue.size() > m_max_depth)){
-    m_queue.pop(); //drop an audio frame from the queue
-    printf("!"); fflush(stdout);
+bool send_worker::queue_push(send_frame* frame){
+  trace_scope trace(trace_fine, "queue push");
+  if(!m_queue.push(frame)){
+   return false;
   }
-  lock_queue.unlock(); //unlock the queue
-  m_condvar.notify_one(); //notify the listener that there is data
+  sem_post(&m_ready); //lock-free - only enters the kernel to wake a waiting worker
+  return true;
 }
 
-jack_default_audio_sample_t** send_audio::queue_pop_opt(void){
- // Lock the queue
- std::unique_lock<std::mutex> lock_queue(m_lock); 
- if(m_queue.empty()) {
-  return {};
+send_frame* send_worker::queue_pop_opt(void){
+ trace_scope trace(trace_fine, "queue pop");
+ send_frame *item = NULL;
+ if(!m_queue.pop(item)){
+  return NULL;
  }
- //Get the item from the queue
- jack_default_audio_sample_t** item = std::move(m_queue.front());
- m_queue.pop();
- lock_queue.unlock(); //unlock the queue
  return item;
 }
 
-int send_audio::process(jack_nframes_t nframes){
-  //Get JACK Audio Buffers
-  for (int channel = 0; channel < num_channels; channel++){
-   in[channel] = (jack_default_audio_sample_t*)jack_port_get_buffer (in_ports[channel], nframes);
-  }  
-  send_audio::queue_push(std::move(in));
-  num_frames = nframes;
-  return 0;      
-}
-
-void send_audio::process_audio_thread(void){
-  bool exit_thread = false;
-  while (true){
+void send_worker::process_audio_thread(void){
+  rt_threads.apply("sender");
+  rt_flush_denormals(); //resampler tails decay into denormals on silence
+  while (!m_exit){
     queue_wait(); //wait until there is some data to process
     while (true){
      auto frame = queue_pop_opt(); //get the data frame off of the queue
      if(!frame){ //no data - wait for more data at queue_wait()
       break; 
-     } 
-     m_NDI_audio_frame.no_samples = num_frames;
-     m_NDI_audio_frame.p_data = (float*)malloc(num_frames * num_channels * sizeof(float));
-	   m_NDI_audio_frame.channel_stride_in_bytes = num_frames * sizeof(float);
-
-    if(m_NDI_audio_frame.p_data != 0){ //make sure that there is data in the buffer before trying to copy anything
-     for (int channel = 0; channel < num_channels; channel++){
-      float* p_ch = (float*)((uint8_t*)m_NDI_audio_frame.p_data + channel*m_NDI_audio_frame.channel_stride_in_bytes); //Initialize channels in NDI frame
-      memcpy(p_ch, frame[channel], sizeof(jack_default_audio_sample_t) * num_frames); //copy the audio frame from JACK buffer to the NDI frame
      }
+     frame->stream->m_queued--;
+     frame->stream->send(frame);
+    }
+  }
+}
+
+//Constructor
+send_worker::send_worker(void): m_exit(false){
+  sem_init(&m_ready, 0, 0);
+  audio_thread = std::thread(&send_worker::process_audio_thread, this); //start the audio processing in its own thread
+}
+
+// Destructor
+send_worker::~send_worker(void){
+  m_exit = true;
+  sem_post(&m_ready); //the semaphore counts the wakeup, so it is not lost if the worker is not waiting yet
+  audio_thread.join();
+  sem_destroy(&m_ready);
+}
+
+/**
+ * Single pass over the JACK input buffers: every listening stream gets its
+ * channels copied into its next frame, which is then handed to the stream's
+ * sender thread.
+ */
+int send_audio::process(jack_nframes_t nframes){
+  num_frames = nframes;
+  if(nframes > max_period){ //period is larger than the preallocated frames
+   return 0;
+  }
+  jack_time_t process_start = jack_get_time();
+  //Get JACK Audio Buffers
+  for (int port = 0; port < num_inputs; port++){
+   in[port] = (jack_default_audio_sample_t*)jack_port_get_buffer (in_ports[port], nframes);
+  }
+  jack_time_t usecs = jack_frames_to_time(jack_client, jack_last_frame_time(jack_client)); //time of the first sample in this period
+  bool freewheel = m_freewheel.load(std::memory_order_relaxed);
+  jack_time_t freewheel_start = freewheel ? jack_get_time() : 0;
+  for (ndi_stream *stream : m_streams){
+   if(!stream->m_listening.load(std::memory_order_relaxed)){ //nobody is listening - skip the copy and send
+    continue;
+   }
+   if(!freewheel && (stream->m_queued.load() >= (int)m_max_depth)){ //the sender thread is not keeping up - drop this frame
+    stream->m_frames_dropped++;
+    trace_mark(trace_coarse, "frame dropped"); //counted for the stats - printing here would block the RT thread
+    continue;
+   }
+   //Copy the JACK Audio Buffers into the next free frame, measuring the peak as we go
+   jack_time_t copy_start = jack_get_time();
+   send_frame *frame = freewheel ? stream->scratch_frame() : stream->next_frame(); //back to back freewheel cycles would wrap the pool under the sender threads
+   frame->no_samples = nframes;
+   frame->peak = 0.0f;
+   frame->usecs = usecs;
+   frame->timecode = (int64_t)usecs * 10 + jack_utc_offset.load(std::memory_order_relaxed);
+   for (int channel = 0; channel < stream->num_channels; channel++){
+    float peak = copy_abs_max(frame->p_data + channel * nframes, in[stream->m_channels[channel]], nframes);
+    if(peak > frame->peak){
+     frame->peak = peak;
     }
-    // Send the NDI audio frame
-    NDIlib_send_send_audio_v2(m_pNDI_send, &m_NDI_audio_frame);
-    free(m_NDI_audio_frame.p_data); //free the audio frame
    }
+   stream->m_copy_us += jack_get_time() - copy_start;
+   if(freewheel){ //NDI is real time - the copy is only timed, never sent
+    continue;
+   }
+   stream->m_queued++;
+   if(!m_workers[stream->m_worker]->queue_push(frame)){ //more frames waiting than the queue holds - drop rather than block
+    stream->m_queued--;
+    stream->m_frames_dropped++;
+   }
+  }
+  if(freewheel){
+   m_freewheel_frames += nframes;
+   m_freewheel_us += jack_get_time() - freewheel_start;
+  }else{ //freewheel cycles run back to back and say nothing about the load
+   m_governor.record_cycle(jack_get_time() - process_start);
+  }
+  return 0;      
+}
+
+send_frame* ndi_stream::next_frame(void){
+  send_frame *frame = &m_frames[m_frame_index];
+  m_frame_index = (m_frame_index + 1) % frame_pool_size;
+  return frame;
+}
+
+void ndi_stream::send(send_frame *frame){
+  using namespace std::chrono;
+  stream_rate *next = m_pending_rate.exchange(NULL, std::memory_order_acquire);
+  if(next){ //the JACK sample rate changed - frames from here on are at the new rate
+   delete m_rate;
+   m_rate = next;
+   m_NDI_audio_frame.sample_rate = m_rate->send_rate;
+  }
+  auto now = steady_clock::now();
+  if(frame->peak > silence_threshold){ //sound - the whole frame is sent so the onset is never clipped
+   m_last_sound = now;
+   if(m_gated){
+    m_gated = false;
+    printf("%s: signal detected - sending full rate\n", m_ndi_name.c_str());
+   }
+  }else if((silence_hold_ms > 0) && !m_gated && (now - m_last_sound > milliseconds(silence_hold_ms))){
+   m_gated = true;
+   printf("%s: silent for %dms - sending keepalives only\n", m_ndi_name.c_str(), silence_hold_ms);
+  }
+  if(m_gated){
+   if(now - m_last_keepalive < milliseconds(keepalive_ms)){ //drop silent frames between keepalives
+    m_frames_gated++;
+    m_bytes_gated += frame->no_samples * num_channels * sizeof(float);
+    return;
+   }
+   m_last_keepalive = now;
+  }
+  m_NDI_audio_frame.no_samples = frame->no_samples;
+  m_NDI_audio_frame.p_data = frame->p_data;
+	m_NDI_audio_frame.channel_stride_in_bytes = frame->no_samples * sizeof(float);
+  m_NDI_audio_frame.timecode = frame->timecode;
+  if(m_rate->resample){ //convert to the NDI sample rate - the output length varies from frame to frame
+   m_NDI_audio_frame.no_samples = m_rate->conv.process(frame->p_data, frame->no_samples, frame->no_samples, m_rate->out, m_rate->stride);
+   m_NDI_audio_frame.p_data = m_rate->out;
+   m_NDI_audio_frame.channel_stride_in_bytes = m_rate->stride * sizeof(float);
+   m_resample_us += duration_cast<microseconds>(steady_clock::now() - now).count();
+  }
+
+  // Send the NDI audio frame
+  uint64_t send_delay = jack_get_time() - frame->usecs; //how long after the period started the frame went out
+  auto send_start = steady_clock::now();
+  {
+   trace_scope trace(trace_coarse, "ndi send");
+   NDIlib_send_send_audio_v2(m_pNDI_send, &m_NDI_audio_frame);
+  }
+  m_jitter_count++;
+  m_jitter_sum += send_delay;
+  m_jitter_sum_sq += send_delay * send_delay;
+  if(send_delay > m_jitter_max){
+   m_jitter_max = send_delay;
+  }
+  m_send_us += duration_cast<microseconds>(steady_clock::now() - send_start).count();
+  m_frames_sent++;
+}
+
+/**
+ * Watches the number of NDI receivers connected to this sender so that
+ * process() only copies and sends audio while someone is listening.
+ * While idle, NDIlib_send_get_no_connections() blocks until a receiver
+ * connects, so sending resumes on the very next JACK period.
+ */
+void ndi_stream::connection_thread(void){
+  using namespace std::chrono;
+  auto last_time = steady_clock::now();
+  while(!m_exit){
+   bool listening = m_listening.load();
+   int no_connections = NDIlib_send_get_no_connections(m_pNDI_send, listening ? 0 : 100); //wait for a receiver while idle
+   if(listening){
+    std::this_thread::sleep_for(milliseconds(100)); //check for disconnects every 100ms
+   }
+   auto now = steady_clock::now();
+   uint64_t elapsed_ms = duration_cast<milliseconds>(now - last_time).count();
+   last_time = now;
+   if(listening){
+    m_active_ms += elapsed_ms;
+   }else{
+    m_idle_ms += elapsed_ms;
+   }
+   if((no_connections > 0) != listening){
+    m_listening = (no_connections > 0);
+    printf("%s: %d NDI receiver(s) connected - %s\n", m_ndi_name.c_str(), no_connections, (no_connections > 0) ? "sending" : "idle");
+   }
+  }
+}
+
+void ndi_stream::print_stats(void){
+  uint64_t active_ms = m_active_ms.load();
+  uint64_t idle_ms = m_idle_ms.load();
+  printf("%s: %s, active %.1fs, idle %.1fs\n", m_ndi_name.c_str(), m_listening ? "sending" : "idle", active_ms / 1000.0, idle_ms / 1000.0);
+  uint64_t frames_sent = m_frames_sent.load();
+  uint64_t frames_gated = m_frames_gated.load();
+  double send_ms = m_send_us.load() / 1000.0;
+  double saved_ms = (frames_sent > 0) ? send_ms * frames_gated / frames_sent : 0.0; //estimated from the average send cost
+  if((int)m_jack_rate.load() != m_send_rate.load()){
+   printf("%s: resampling %d to %d, %.1fms total, %.1fus per frame\n", m_ndi_name.c_str(), (int)m_jack_rate.load(), m_send_rate.load(),
+          m_resample_us.load() / 1000.0, (frames_sent > 0) ? (double)m_resample_us.load() / frames_sent : 0.0);
+  }
+  printf("%s: %s, %llu frames sent (%.1fms), %llu silent frames skipped, saved %.1fKB and ~%.1fms CPU\n", m_ndi_name.c_str(), m_gated ? "silence gated" : "full rate",
+         (unsigned long long)frames_sent, send_ms, (unsigned long long)frames_gated, m_bytes_gated.load() / 1024.0, saved_ms);
+  uint64_t jitter_count = m_jitter_count.load();
+  if(jitter_count > 0){ //send delay after the JACK period start - the deviation is the send jitter
+   double mean = (double)m_jitter_sum.load() / jitter_count;
+   double variance = (double)m_jitter_sum_sq.load() / jitter_count - mean * mean;
+   printf("%s: send delay from JACK clock mean %.0fus, jitter %.0fus, max %lluus\n", m_ndi_name.c_str(), mean, sqrt(variance > 0.0 ? variance : 0.0), (unsigned long long)m_jitter_max.load());
+  }
+  double copy_ms = m_copy_us.load() / 1000.0;
+  printf("%s: CPU %.1fms total (copy %.1fms, resample %.1fms, send %.1fms), %llu frames dropped\n", m_ndi_name.c_str(), copy_ms + m_resample_us.load() / 1000.0 + send_ms,
+         copy_ms, m_resample_us.load() / 1000.0, send_ms, (unsigned long long)m_frames_dropped.load());
+}
+
+//Constructor
+ndi_stream::ndi_stream(const stream_config &config, jack_nframes_t sample_rate, jack_nframes_t frame_capacity, int worker): m_ndi_name(config.ndi_name), m_channels(config.channels), m_worker(worker), m_listening(false), m_queued(0), m_frames_dropped(0), m_copy_us(0), m_pNDI_send(NULL), m_frame_capacity(frame_capacity), m_pending_rate(NULL), m_jack_rate(0), m_send_rate(0), m_quality(resample_quality), m_latency(0), m_active_ms(0), m_idle_ms(0), m_frames_sent(0), m_frames_gated(0), m_bytes_gated(0), m_send_us(0), m_resample_us(0), m_gated(false), m_jitter_count(0), m_jitter_sum(0), m_jitter_sum_sq(0), m_jitter_max(0), m_exit(false){
+  num_channels = m_channels.size();
+  printf("Starting Sender for %s with %d channel(s)\n", m_ndi_name.c_str(), num_channels);
+
+  // Create an NDI source
+	NDIlib_send_create_t NDI_send_create_desc;
+	NDI_send_create_desc.p_ndi_name = m_ndi_name.c_str();
+	NDI_send_create_desc.clock_audio = clock_audio; //pace sends on the NDI clock instead of the JACK callback
+  
+  //Create the NDI sender using the description
+  {
+   rt_thread_scope scope(rt_threads, "ndi"); //threads the SDK starts for the sender get the NDI placement
+   m_pNDI_send = NDIlib_send_create(&NDI_send_create_desc);
+  }
+
+  for (int i = 0; i < frame_pool_size; i++){ //preallocate the frames so process() never allocates
+   m_frames[i].stream = this;
+   m_frames[i].p_data = (float*)malloc(frame_capacity * num_channels * sizeof(float));
+   rt_prefault(m_frames[i].p_data, frame_capacity * num_channels * sizeof(float)); //the RT thread writes these - no page faults on its first cycles
+   m_frames[i].no_samples = 0;
+   m_frames[i].peak = 0.0f;
+  }
+  m_scratch.stream = this;
+  m_scratch.p_data = (float*)malloc(frame_capacity * num_channels * sizeof(float));
+  rt_prefault(m_scratch.p_data, frame_capacity * num_channels * sizeof(float));
+  m_scratch.no_samples = 0;
+  m_scratch.peak = 0.0f;
+
+  m_rate = make_rate(sample_rate);
+  m_NDI_audio_frame.sample_rate = m_rate->send_rate;
+	m_NDI_audio_frame.no_channels = num_channels;
+  m_last_sound = std::chrono::steady_clock::now();
+  m_last_keepalive = m_last_sound;
+  monitor_thread = std::thread(&ndi_stream::connection_thread, this); //start watching for NDI receivers
+}
+
+// Destructor
+ndi_stream::~ndi_stream(void){
+  m_exit = true;
+  monitor_thread.join();
+  NDIlib_send_destroy(m_pNDI_send);
+  for (int i = 0; i < frame_pool_size; i++){
+   free(m_frames[i].p_data);
+  }
+  free(m_scratch.p_data);
+  delete m_rate;
+  delete m_pending_rate.load();
+}
+
+/**
+ * Set up sending at the JACK rate, or resampling from it when the NDI
+ * stream runs at another rate.
+ */
+stream_rate* ndi_stream::make_rate(jack_nframes_t rate){
+  stream_rate *next = new stream_rate();
+  next->jack_rate = rate;
+  next->send_rate = rate;
+  if((ndi_sample_rate > 0) && (ndi_sample_rate != (int)rate)){ //JACK runs at a different rate than the NDI stream
+   if(next->conv.setup(rate, ndi_sample_rate, num_channels, m_frame_capacity, (resampler_quality)m_quality.load())){
+    next->stride = next->conv.max_output();
+    next->out = (float*)malloc(next->stride * num_channels * sizeof(float));
+    rt_prefault(next->out, next->stride * num_channels * sizeof(float));
+    next->resample = true;
+    next->send_rate = ndi_sample_rate;
+    printf("Resampling from %d to %d\n", (int)rate, ndi_sample_rate);
+   }else{
+    fprintf(stderr, "cannot resample from %d to %d - sending at the JACK rate\n", (int)rate, ndi_sample_rate);
+   }
+  }
+  m_jack_rate = next->jack_rate;
+  m_send_rate = next->send_rate;
+  m_latency = next->resample ? next->conv.delay() : 0;
+  return next;
+}
+
+//Build the rate state here and let the sender thread swap it in, so the resampler is never set up while it runs
+void ndi_stream::set_jack_rate(jack_nframes_t rate){
+  std::lock_guard<std::mutex> lock(m_rate_lock);
+  if(rate == m_jack_rate.load()){
+   return;
+  }
+  delete m_pending_rate.exchange(make_rate(rate), std::memory_order_acq_rel); //a rate the sender thread never took is dropped
+}
+
+//Rebuild the resampler with another filter length, swapped in by the sender thread like a rate change
+void ndi_stream::set_resample_quality(resampler_quality quality){
+  std::lock_guard<std::mutex> lock(m_rate_lock);
+  if((m_quality.exchange(quality) == quality) || ((int)m_jack_rate.load() == m_send_rate.load())){ //unchanged, or not resampling
+   return;
+  }
+  delete m_pending_rate.exchange(make_rate(m_jack_rate.load()), std::memory_order_acq_rel);
+}
+
+void send_audio::print_stats(void){
+  for (ndi_stream *stream : m_streams){
+   stream->print_stats();
+  }
+  if(m_governor.level() != load_level_full){
+   printf("%s: load %s, resampling at reduced quality\n", m_client_name.c_str(), load_governor::level_name(m_governor.level()));
+  }
+  if(m_supervisor.m_restarts.load() > 0){
+   printf("%s: survived %llu JACK restart(s), last recovery %llums\n", m_client_name.c_str(), (unsigned long long)m_supervisor.m_restarts.load(), (unsigned long long)m_supervisor.m_last_recovery_ms.load());
   }
 }
 
 /**
  * JACK calls this shutdown_callback if the server ever shuts down or
- * decides to disconnect the client.
+ * decides to disconnect the client. The NDI senders stay up and the
+ * supervisor thread reconnects once the server is back.
  */
 void send_audio::jack_shutdown(void *arg){
-  exit(1);
+  static_cast<send_audio*>(arg)->m_supervisor.lost();
+}
+
+/**
+ * JACK calls this when the server sample rate changes, and once when the
+ * callback is set. Each stream rebuilds its resampler for the new rate.
+ */
+int send_audio::sample_rate_callback(jack_nframes_t nframes, void *arg){
+  send_audio *sender = static_cast<send_audio*>(arg);
+  if(nframes != sender->jack_sample_rate){
+   printf("%s: JACK sample rate changed from %d to %d Hz\n", sender->m_client_name.c_str(), (int)sender->jack_sample_rate, (int)nframes);
+   sender->jack_sample_rate = nframes;
+  }
+  for (ndi_stream *stream : sender->m_streams){
+   stream->set_jack_rate(nframes);
+  }
+  sender->m_latency_changed = true; //the resamplers may add a different delay
+  return 0;
+}
+
+/**
+ * Publish how long after a period the inputs go out as NDI: one period to
+ * fill the frame, up to m_max_depth more waiting for the sender thread, and
+ * the resampler delay of the streams the input feeds. There are no outputs,
+ * so there is no capture latency to pass downstream.
+ */
+void send_audio::latency_callback(jack_latency_callback_mode_t mode, void *arg){
+  send_audio *sender = static_cast<send_audio*>(arg);
+  if(mode != JackPlaybackLatency){
+   return;
+  }
+  jack_nframes_t period = jack_get_buffer_size(sender->jack_client);
+  for (int port = 0; port < sender->num_inputs; port++){
+   int resampler_delay = 0;
+   for (ndi_stream *stream : sender->m_streams){
+    if(std::find(stream->m_channels.begin(), stream->m_channels.end(), port) != stream->m_channels.end()){
+     resampler_delay = std::max(resampler_delay, stream->m_latency.load());
+    }
+   }
+   jack_latency_range_t range;
+   range.min = period + resampler_delay;
+   range.max = period * (1 + sender->m_max_depth) + resampler_delay;
+   jack_port_set_latency_range(sender->in_ports[port], JackPlaybackLatency, &range);
+  }
+}
+
+/**
+ * JACK freewheels for offline bounces, calling process as fast as it can.
+ * Sending at that speed would flood the NDI receivers, so sends are
+ * suspended until JACK runs in real time again; the inputs are still
+ * copied, into a scratch frame outside the send pool, so the process
+ * callback's throughput can be measured.
+ */
+void send_audio::freewheel_callback(int starting, void *arg){
+  send_audio *sender = static_cast<send_audio*>(arg);
+  if(starting){
+   sender->m_freewheel_frames = 0;
+   sender->m_freewheel_us = 0;
+   sender->m_freewheel = true;
+   printf("%s: JACK is freewheeling - NDI sends suspended\n", sender->m_client_name.c_str());
+   return;
+  }
+  sender->m_freewheel = false;
+  uint64_t frames = sender->m_freewheel_frames.load();
+  uint64_t process_us = sender->m_freewheel_us.load();
+  double audio_us = frames * 1000000.0 / sender->jack_sample_rate;
+  printf("%s: freewheel ended - %llu frames in %.1fms of process time, %.0fx real time\n", sender->m_client_name.c_str(), (unsigned long long)frames, process_us / 1000.0,
+         (process_us > 0) ? audio_us / process_us : 0.0);
+}
+
+//The frames are sized for max_period, so a new period needs no reallocation
+int send_audio::buffer_size_callback(jack_nframes_t nframes, void *arg){
+  send_audio *sender = static_cast<send_audio*>(arg);
+  printf("%s: JACK period is %d samples\n", sender->m_client_name.c_str(), (int)nframes);
+  if(nframes > max_period){
+   fprintf(stderr, "%s: JACK period is longer than %d samples - nothing is sent\n", sender->m_client_name.c_str(), (int)max_period);
+  }
+  return 0;
+}
+
+/**
+ * Step the resampler quality down one notch when the load governor reports
+ * high load and to the shortest filter when it is at its minimum. The audio
+ * itself is never dropped; the resamplers run on the sender threads and
+ * are the largest cost we control.
+ */
+void send_audio::apply_load_level(void){
+  int level = m_governor.level();
+  resampler_quality quality = resample_quality;
+  if(level == load_level_reduced){
+   quality = (resampler_quality)std::max((int)resample_quality - 1, (int)resampler_quality_low);
+  }else if(level == load_level_minimal){
+   quality = resampler_quality_low;
+  }
+  for (ndi_stream *stream : m_streams){
+   stream->set_resample_quality(quality);
+  }
+  m_latency_changed = true; //the filter length is the resampler latency
+}
+
+/**
+ * Remember the input connections once a second and, after a JACK restart,
+ * open the client again with the same name and ports and put them back.
+ */
+void send_audio::supervise(void){
+  int ticks = 0;
+  while (!m_exit){
+   std::this_thread::sleep_for(std::chrono::milliseconds(250));
+   if(!m_supervisor.is_lost()){
+    if(++ticks % 4 == 0){
+     m_supervisor.remember(jack_client, in_ports, num_inputs);
+     update_utc_offset();
+     for (ndi_stream *stream : m_streams){ //the process callback only counts its drops
+      uint64_t dropped = stream->m_frames_dropped.load();
+      if(dropped != stream->m_drops_reported){
+       printf("%s: %llu frames dropped - the sender thread is not keeping up\n", stream->m_ndi_name.c_str(), (unsigned long long)(dropped - stream->m_drops_reported));
+       stream->m_drops_reported = dropped;
+      }
+     }
+    }
+    if(!m_freewheel && m_governor.sample(jack_client, 250, m_client_name.c_str())){
+     apply_load_level();
+    }
+    if(m_latency_changed.exchange(false)){ //not allowed from the callbacks themselves
+     jack_recompute_total_latencies(jack_client);
+    }
+    continue;
+   }
+   fprintf(stderr, "%s: JACK server went away - reconnecting\n", m_client_name.c_str());
+   jack_client_close(jack_client);
+   jack_client = m_supervisor.reopen(m_client_name.c_str(), m_exit);
+   if(jack_client == NULL){
+    return;
+   }
+   jack_set_process_callback (jack_client, ::process_callback, this);
+   jack_set_sample_rate_callback (jack_client, send_audio::sample_rate_callback, this); //picks up a server restarted at another rate
+   jack_set_buffer_size_callback (jack_client, send_audio::buffer_size_callback, this);
+   jack_set_latency_callback (jack_client, send_audio::latency_callback, this);
+   jack_set_freewheel_callback (jack_client, send_audio::freewheel_callback, this);
+   m_freewheel = false; //a new server starts in real time
+   jack_on_shutdown (jack_client, send_audio::jack_shutdown, this);
+   jack_set_thread_init_callback (jack_client, rt_thread_init, NULL);
+   bool registered = true;
+   for (int channel = 0; channel < num_inputs; channel++){
+    std::string channel_name_string = "input" + std::to_string(channel);
+    in_ports[channel] = jack_port_register (jack_client, channel_name_string.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    registered = registered && (in_ports[channel] != NULL);
+   }
+   if(!registered){
+    fprintf (stderr, "%s: cannot register JACK ports\n", m_client_name.c_str());
+    continue; //still marked lost - try again, before process() can see a NULL port
+   }
+   if(jack_activate (jack_client)){
+    fprintf (stderr, "cannot activate client");
+    continue; //still marked lost - try again
+   }
+   update_utc_offset(); //a new server may run another clock
+   m_supervisor.restore(jack_client, in_ports, num_inputs);
+   m_supervisor.recovered();
+  }
 }
 
 //Constructor
-send_audio::send_audio(const char *c_name, const char *n_name, bool a_ports): m_pNDI_send(NULL), m_exit(false), jack_client(NULL){
-  printf("Starting Sender for %s\n", n_name);
+send_audio::send_audio(const char *c_name, const std::vector<stream_config> &streams, int no_inputs, int no_workers, bool a_ports): m_exit(false), jack_client(NULL), m_freewheel(false), m_freewheel_frames(0), m_freewheel_us(0), m_latency_changed(false){
   printf("Connecting to JACK as %s\n", c_name);
   const char **ports;
   const char *server_name = NULL;
   jack_options_t options = JackNullOption;
   jack_status_t status;
-
-  // Create an NDI source
-	NDIlib_send_create_t NDI_send_create_desc;
-	NDI_send_create_desc.p_ndi_name = n_name;
-	//NDI_send_create_desc.clock_audio = true;
-  
-  //Create the NDI sender using the description
-  m_pNDI_send = NDIlib_send_create(&NDI_send_create_desc);
+  num_inputs = no_inputs;
 
   /* open a client connection to the JACK server */
   jack_client = jack_client_open (c_name, options, &status, server_name);
@@ -174,19 +743,34 @@ send_audio::send_audio(const char *c_name, const char *n_name, bool a_ports): m_
    //client_name = jack_get_client_name(jack_client);
    //fprintf (stderr, "unique name `%s' assigned\n", client_name);
   }
+  m_client_name = jack_get_client_name(jack_client);
+  update_utc_offset(); //the JACK clock is only valid once a client is open
 
   jack_sample_rate = jack_get_sample_rate(jack_client);
+  num_frames = jack_get_buffer_size(jack_client);
+
+  //create the sender threads and the NDI streams, spread round robin over the threads
+  for (int i = 0; i < no_workers; i++){
+   m_workers.push_back(new send_worker());
+  }
+  for (size_t i = 0; i < streams.size(); i++){
+   m_streams.push_back(new ndi_stream(streams[i], jack_sample_rate, max_period, i % no_workers));
+  }
   
   jack_set_process_callback (jack_client, ::process_callback, this); //This callback is called on every every time JACK does work - every audio sample
-  jack_on_shutdown (jack_client, send_audio::jack_shutdown, 0); //JACK shutdown callback - gets called on JACK shutdown
+  jack_set_sample_rate_callback (jack_client, send_audio::sample_rate_callback, this);
+  jack_set_buffer_size_callback (jack_client, send_audio::buffer_size_callback, this);
+  jack_set_latency_callback (jack_client, send_audio::latency_callback, this); //lets clients compensate for the time until the NDI send
+  jack_set_freewheel_callback (jack_client, send_audio::freewheel_callback, this);
+  jack_on_shutdown (jack_client, send_audio::jack_shutdown, this); //JACK shutdown callback - gets called on JACK shutdown
+  jack_set_thread_init_callback (jack_client, rt_thread_init, NULL); //flush denormals and prefault the stack in the RT thread
 
   //initialize data structures for variable channels
-  in_ports = (jack_port_t**)malloc(sizeof (jack_port_t*) * num_channels);
-  size_t in_size = num_channels * sizeof(jack_default_audio_sample_t*);
-  in = (jack_default_audio_sample_t**)malloc(in_size);
+  in_ports = (jack_port_t**)malloc(sizeof (jack_port_t*) * num_inputs);
+  in = (jack_default_audio_sample_t**)malloc(sizeof (jack_default_audio_sample_t*) * num_inputs);
 
   /* create input JACK ports */
-  for (int channel = 0; channel < num_channels; channel++){
+  for (int channel = 0; channel < num_inputs; channel++){
    std::string channel_name_string = "input" + std::to_string(channel);
    //std::cout << "Current Channel Name: " << channel_name_string << std::endl;
    const char* channel_name_char = channel_name_string.c_str();
@@ -220,28 +804,32 @@ send_audio::send_audio(const char *c_name, const char *n_name, bool a_ports): m_
     exit (1);
    }
 
-   if(jack_connect (jack_client, ports[0], jack_port_name (in_ports[0]))){
-    fprintf(stderr, "cannot connect input ports\n");
-   }
-
-   if(jack_connect (jack_client, ports[1], jack_port_name (in_ports[1]))){
-    fprintf (stderr, "cannot connect input ports\n");
+   trace_scope trace(trace_coarse, "jack connect");
+   for (int channel = 0; (channel < num_inputs) && ports[channel]; channel++){ //connect as many inputs as there are capture ports
+    if(jack_connect (jack_client, ports[channel], jack_port_name (in_ports[channel]))){
+     fprintf(stderr, "cannot connect input ports\n");
+    }
    }
 
    jack_free (ports);
   }
-
-  m_NDI_audio_frame.sample_rate = jack_sample_rate;
-	m_NDI_audio_frame.no_channels = num_channels;
-  audio_thread = std::thread(&send_audio::process_audio_thread, this); //start the audio processing in its own thread
+  m_supervisor_thread = std::thread(&send_audio::supervise, this);
 }
 
 // Destructor
 send_audio::~send_audio(void){	// Wait for the thread to exit
 	m_exit = true;
-	jack_client_close(jack_client);
-	// Destroy the sender thread
-  audio_thread.join();
+  m_supervisor_thread.join();
+  if(jack_client){ //NULL if we were still waiting for JACK to come back
+	 jack_client_close(jack_client);
+  }
+	// Destroy the sender threads and streams
+  for (send_worker *worker : m_workers){
+   delete worker;
+  }
+  for (ndi_stream *stream : m_streams){
+   delete stream;
+  }
 }
 
 /**
@@ -249,6 +837,8 @@ send_audio::~send_audio(void){	// Wait for the thread to exit
  * special realtime thread once for each audio cycle.
  */
 int process_callback(jack_nframes_t x, void *p){
+ rt_check_scope scope; //with -DRT_CHECK, records anything in the cycle that allocates or blocks
+ trace_scope trace(trace_coarse, "jack process");
  return static_cast<send_audio*>(p)->process(x); 
 }
 
@@ -256,6 +846,62 @@ static const int no_senders = 30; //max number of senders
 send_audio* p_senders[no_senders] = { 0 };
 std::string ndi_running_name[no_senders] = { "" };
 
+/**
+ * Work out which JACK inputs feed which NDI stream: from the map file if
+ * one was given, otherwise by splitting the inputs evenly, otherwise one
+ * stream carrying every input.
+ */
+static std::vector<stream_config> get_stream_configs(void){
+  std::vector<stream_config> streams;
+  if(map_file != NULL){
+   std::ifstream config_file(map_file);
+   std::string line;
+   while(getline(config_file, line)){
+    size_t separator = line.find('=');
+    if(line.empty() || (line[0] == '#') || (separator == std::string::npos)){ //skip comments and blank lines
+     continue;
+    }
+    stream_config stream;
+    stream.ndi_name = line.substr(0, separator);
+    std::string channel_list = line.substr(separator + 1);
+    size_t start = 0;
+    while(start < channel_list.size()){
+     size_t end = channel_list.find(',', start);
+     if(end == std::string::npos){
+      end = channel_list.size();
+     }
+     int channel = atoi(channel_list.substr(start, end - start).c_str());
+     if((channel >= 0) && (channel < num_inputs)){
+      stream.channels.push_back(channel);
+     }else{
+      fprintf(stderr, "%s: input %d does not exist\n", stream.ndi_name.c_str(), channel);
+     }
+     start = end + 1;
+    }
+    if(!stream.channels.empty()){
+     streams.push_back(stream);
+    }
+   }
+  }else if(split_channels > 0){
+   for (int first = 0; first + split_channels <= num_inputs; first += split_channels){
+    stream_config stream;
+    stream.ndi_name = std::string(ndi_name) + " " + std::to_string(first / split_channels + 1);
+    for (int channel = first; channel < first + split_channels; channel++){
+     stream.channels.push_back(channel);
+    }
+    streams.push_back(stream);
+   }
+  }else{
+   stream_config stream;
+   stream.ndi_name = ndi_name;
+   for (int channel = 0; channel < num_inputs; channel++){
+    stream.channels.push_back(channel);
+   }
+   streams.push_back(stream);
+  }
+  return streams;
+}
+
 static void usage(FILE *fp, int argc, char **argv){
         fprintf(fp,
                  "Usage: JACK to NDI [options]\n\n"
@@ -265,11 +911,24 @@ static void usage(FILE *fp, int argc, char **argv){
                  "-n | --ndi-name      NDI output stream name\n"
                  "-j | --jack-name     JACK client name\n"
                  "-a | --auto-connect  Disable auto connect JACK ports (default to true)\n"
+                 "-s | --stats         Print sender stats every N seconds\n"
+                 "-g | --silence-hold  Send only keepalives after N ms of silence (default off)\n"
+                 "-t | --silence-threshold  Silence threshold in dBFS (default -80)\n"
+                 "-k | --keepalive     Keepalive interval in ms while silent (default 1000)\n"
+                 "-c | --clock-audio   Let NDI pace the audio sends (default off)\n"
+                 "-r | --ndi-rate      Resample to this NDI sample rate, e.g. 48000 (default JACK rate)\n"
+                 "-q | --resample-quality  low, medium or high (default medium)\n"
+                 "-i | --inputs        Number of JACK input ports (default 2)\n"
+                 "-p | --split         Split the inputs into NDI streams of N channels each\n"
+                 "-m | --map           File with one NDI stream per line: name=input,input,...\n"
+                 "-w | --sender-threads  Number of NDI sender threads\n"
+                 "-A | --affinity      CPUs and priority per thread role: control=0;ndi=1@0;sender=2-3@70\n"
+                 "-T | --trace         Trace detail off, coarse or fine, dumped on SIGUSR1 (default coarse)\n"
                  "",
                  argv[0]);
 }
 
-static const char short_options[] = "n:j:a";
+static const char short_options[] = "n:j:as:g:t:k:cr:q:i:p:m:w:A:T:";
 
 static const struct option
 long_options[] = {
@@ -277,6 +936,19 @@ long_options[] = {
         { "ndi-name", required_argument, NULL, 'n' },
         { "jack-name", required_argument, NULL, 'j' },
         { "auto-connect", no_argument,       NULL, 'a' },
+        { "stats", required_argument, NULL, 's' },
+        { "silence-hold", required_argument, NULL, 'g' },
+        { "silence-threshold", required_argument, NULL, 't' },
+        { "keepalive", required_argument, NULL, 'k' },
+        { "clock-audio", no_argument, NULL, 'c' },
+        { "ndi-rate", required_argument, NULL, 'r' },
+        { "resample-quality", required_argument, NULL, 'q' },
+        { "inputs", required_argument, NULL, 'i' },
+        { "split", required_argument, NULL, 'p' },
+        { "map", required_argument, NULL, 'm' },
+        { "sender-threads", required_argument, NULL, 'w' },
+        { "affinity", required_argument, NULL, 'A' },
+        { "trace", required_argument, NULL, 'T' },
         { 0, 0, 0, 0 }
 };
 
@@ -302,12 +974,66 @@ int main (int argc, char **argv){
      break;  
     case 'a':
      auto_connect_jack_ports = false;
-     break;           
+     break;
+    case 's':
+     stats_interval = atoi(optarg);
+     break;
+    case 'g':
+     silence_hold_ms = atoi(optarg);
+     break;
+    case 't':
+     silence_threshold = powf(10.0f, atof(optarg) / 20.0f); //convert dBFS to linear
+     break;
+    case 'k':
+     keepalive_ms = atoi(optarg);
+     break;
+    case 'c':
+     clock_audio = true;
+     break;
+    case 'r':
+     ndi_sample_rate = atoi(optarg);
+     break;
+    case 'q':
+     if(strcmp(optarg, "low") == 0){
+      resample_quality = resampler_quality_low;
+     }else if(strcmp(optarg, "high") == 0){
+      resample_quality = resampler_quality_high;
+     }else{
+      resample_quality = resampler_quality_medium;
+     }
+     break;
+    case 'i':
+     num_inputs = atoi(optarg);
+     break;
+    case 'p':
+     split_channels = atoi(optarg);
+     break;
+    case 'm':
+     map_file = optarg;
+     break;
+    case 'w':
+     num_workers = atoi(optarg);
+     break;
+    case 'A':
+     if(!rt_threads.parse(optarg, { "control", "ndi", "sender" })){
+      usage(stderr, argc, argv);
+      exit(EXIT_FAILURE);
+     }
+     break;
+    case 'T':
+     if(!trace_parse_level(optarg)){
+      usage(stderr, argc, argv);
+      exit(EXIT_FAILURE);
+     }
+     break;
     default:
      usage(stderr, argc, argv);
      exit(EXIT_FAILURE);
    }
   }
+  rt_threads.lock_memory(); //before the senders allocate their frames
+  rt_threads.apply("control"); //threads started from here on inherit this until they apply their own role
+  trace_install_signal();
   
   if(!NDIlib_initialize()){	
 	 printf("Cannot run NDI."); // Cannot run NDI. Most likely because the CPU is not sufficient.
@@ -322,11 +1048,37 @@ int main (int argc, char **argv){
    }else{
     printf("No Auto Connect Ports\n"); 
    }
-   p_senders[0] = new send_audio(client_name,ndi_name,auto_connect_jack_ports);
+   std::vector<stream_config> streams = get_stream_configs();
+   if(streams.empty()){
+    fprintf(stderr, "no NDI streams configured\n");
+    exit(EXIT_FAILURE);
+   }
+   if(num_workers <= 0){ //one sender thread per stream, but no more than there are cores
+    num_workers = std::min((int)streams.size(), (int)std::max(1u, std::thread::hardware_concurrency()));
+   }
+   p_senders[0] = new send_audio(client_name, streams, num_inputs, num_workers, auto_connect_jack_ports);
                                
   /* keep running until the Ctrl+C */
+  int seconds_running = 0;
+  int rt_check_reported = 0; //call sites already printed
   while(1){
    sleep(1);
+   seconds_running++;
+   trace_poll_signal("jack2ndi");
+   if(rt_check_call_sites() != rt_check_reported){ //-DRT_CHECK builds: the process callback allocated or blocked somewhere new
+    rt_check_reported = rt_check_call_sites();
+    printf("RT check: %s\n", rt_check_report().c_str());
+   }
+   if((stats_interval > 0) && (seconds_running % stats_interval == 0)){ //print stats for every running sender
+    if(rt_check_enabled){
+     printf("RT check: %llu calls from %d call sites\n", (unsigned long long)rt_check_violations(), rt_check_call_sites());
+    }
+    for(int i = 0; i < no_senders; i++){
+     if(p_senders[i]){
+      p_senders[i]->print_stats();
+     }
+    }
+   }
   }
   
   exit (0);
@@ -0,0 +1,291 @@
+/*
+ * Cached view of the JACK port graph and rule based connections
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef JACK_PORT_GRAPH_H
+#define JACK_PORT_GRAPH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <regex>
+#include <algorithm>
+#include <jack/jack.h>
+
+/**
+ * Connect outputs first..last (port numbers, as in output_N) in order to
+ * the input ports whose full name matches pattern, in the order those
+ * ports were registered. Written as "[first[-last]=]regex"; without a
+ * range the rule covers every output.
+ */
+struct connect_rule {
+  int first = 0;
+  int last = INT_MAX;
+  std::string text; //as written, for saving
+  std::regex pattern;
+  bool physical = false; //only match physical ports - the default rule
+};
+
+/**
+ * Parse rules separated by ';'. Returns false, leaving rules untouched, if
+ * a range or regular expression is malformed.
+ */
+static inline bool parse_connect_rules(const std::string &spec, std::vector<connect_rule> &rules){
+  std::vector<connect_rule> parsed;
+  size_t start = 0;
+  while (start <= spec.size()){
+   size_t end = spec.find(';', start);
+   if(end == std::string::npos){
+    end = spec.size();
+   }
+   std::string text = spec.substr(start, end - start);
+   start = end + 1;
+   if(text.empty()){
+    continue;
+   }
+   connect_rule rule;
+   rule.text = text;
+   std::string pattern = text;
+   size_t equals = text.find('=');
+   if((equals != std::string::npos) && (equals > 0) && (text.find_first_not_of("0123456789-") == equals)){ //a leading range
+    std::string range = text.substr(0, equals);
+    pattern = text.substr(equals + 1);
+    size_t dash = range.find('-');
+    rule.first = atoi(range.c_str());
+    rule.last = (dash == std::string::npos) ? rule.first : ((dash + 1 < range.size()) ? atoi(range.c_str() + dash + 1) : INT_MAX);
+    if(rule.last < rule.first){
+     return false;
+    }
+   }
+   try {
+    rule.pattern = std::regex(pattern);
+   } catch (const std::regex_error &error){
+    fprintf(stderr, "bad connection rule %s: %s\n", text.c_str(), error.what());
+    return false;
+   }
+   parsed.push_back(rule);
+  }
+  rules.swap(parsed);
+  return true;
+}
+
+/**
+ * Every port of the JACK graph and its connections, read once when the
+ * client is attached and kept up to date from the registration and connect
+ * callbacks, so connecting a rig does not walk the server's port list again
+ * for each receiver. Input ports registered since the last take_new_ports()
+ * are remembered so rules can be applied to clients that start later.
+ */
+struct jack_port_graph {
+ public:
+  //Follow the graph of client - call before jack_activate(), callbacks cannot be set after
+  void attach(jack_client_t *client){
+   std::lock_guard<std::mutex> lock(m_lock);
+   m_client = client;
+   m_ports.clear();
+   m_names.clear();
+   m_new_ports.clear();
+   jack_set_port_registration_callback(client, jack_port_graph::registration_callback, this);
+   jack_set_port_connect_callback(client, jack_port_graph::connect_callback, this);
+  }
+
+  //Read the ports and connections that exist - call after jack_activate() so nothing is missed in between
+  void load(void){
+   std::lock_guard<std::mutex> lock(m_lock);
+   jack_client_t *client = m_client;
+   const char **names = jack_get_ports(client, NULL, JACK_DEFAULT_AUDIO_TYPE, 0);
+   for (size_t i = 0; names && names[i]; i++){
+    add_port(jack_port_by_name(client, names[i]), false);
+   }
+   for (size_t i = 0; names && names[i]; i++){
+    auto port = m_ports.find(names[i]);
+    if(port == m_ports.end()){
+     continue;
+    }
+    const char **peers = jack_port_get_all_connections(client, jack_port_by_name(client, names[i]));
+    for (size_t n = 0; peers && peers[n]; n++){
+     port->second.connections.insert(peers[n]);
+    }
+    jack_free(peers);
+   }
+   jack_free(names);
+  }
+
+  /**
+   * Outputs to connect for rules, as (our port, peer) name pairs, leaving
+   * out connections that already exist. Only outputs from first_channel on
+   * are considered and, if targets is not empty, only peers in targets.
+   */
+  std::vector<std::pair<std::string, std::string>> plan(const std::vector<connect_rule> &rules, jack_port_t *const *outputs, int count, int first_channel, const std::set<std::string> &targets){
+   std::vector<std::pair<std::string, std::string>> connections;
+   std::lock_guard<std::mutex> lock(m_lock);
+   for (const connect_rule &rule : rules){
+    std::vector<const graph_port*> matches;
+    for (auto &entry : m_ports){
+     const graph_port &port = entry.second;
+     if((port.flags & JackPortIsInput) && (!rule.physical || (port.flags & JackPortIsPhysical)) && std::regex_match(entry.first, rule.pattern)){
+      matches.push_back(&port);
+     }
+    }
+    std::sort(matches.begin(), matches.end(), [](const graph_port *a, const graph_port *b){ return a->order < b->order; });
+    for (int channel = std::max(rule.first, first_channel); (channel <= rule.last) && (channel < count); channel++){
+     size_t match = channel - rule.first;
+     if(match >= matches.size()){
+      break;
+     }
+     const std::string &peer = matches[match]->name;
+     if(!targets.empty() && (targets.find(peer) == targets.end())){
+      continue;
+     }
+     std::string name = jack_port_name(outputs[channel]);
+     auto ours = m_ports.find(name);
+     if((ours != m_ports.end()) && (ours->second.connections.count(peer) > 0)){
+      continue;
+     }
+     connections.push_back(std::make_pair(name, peer));
+    }
+   }
+   return connections;
+  }
+
+  //Input ports registered since the last call
+  std::set<std::string> take_new_ports(void){
+   std::lock_guard<std::mutex> lock(m_lock);
+   std::set<std::string> ports;
+   ports.swap(m_new_ports);
+   return ports;
+  }
+
+  size_t size(void){
+   std::lock_guard<std::mutex> lock(m_lock);
+   return m_ports.size();
+  }
+
+ private:
+  struct graph_port {
+   std::string name;
+   int flags = 0;
+   uint64_t order = 0; //registration order - rules connect in this order
+   std::set<std::string> connections;
+  };
+  std::mutex m_lock;
+  jack_client_t *m_client = NULL;
+  std::map<std::string, graph_port> m_ports; //by full name
+  std::map<jack_port_id_t, std::string> m_names; //callbacks only pass ids, and the port may be gone by the time we look
+  std::set<std::string> m_new_ports;
+  uint64_t m_order = 0;
+
+  //replace is set for a registration: a cached port of that name is stale, e.g. its client restarted
+  void add_port(jack_port_t *port, bool replace){
+   if(port == NULL){
+    return;
+   }
+   const char *type = jack_port_type(port);
+   if((type == NULL) || (strcmp(type, JACK_DEFAULT_AUDIO_TYPE) != 0)){ //only audio ports take part in the rules
+    return;
+   }
+   auto found = m_ports.find(jack_port_name(port));
+   if(found != m_ports.end()){
+    if(!replace){ //seen by both the callback and load()
+     return;
+    }
+    forget_port(jack_port_name(port));
+   }
+   graph_port &entry = m_ports[jack_port_name(port)];
+   entry.name = jack_port_name(port);
+   entry.flags = jack_port_flags(port);
+   entry.order = m_order++;
+  }
+
+  std::string name_of(jack_port_id_t id){
+   auto found = m_names.find(id);
+   if(found != m_names.end()){
+    return found->second;
+   }
+   jack_port_t *port = jack_port_by_id(m_client, id);
+   return port ? jack_port_name(port) : "";
+  }
+
+  static void registration_callback(jack_port_id_t id, int registered, void *arg){
+   jack_port_graph *graph = static_cast<jack_port_graph*>(arg);
+   std::lock_guard<std::mutex> lock(graph->m_lock);
+   if(registered){
+    jack_port_t *port = jack_port_by_id(graph->m_client, id);
+    if(port == NULL){
+     return;
+    }
+    graph->m_names[id] = jack_port_name(port);
+    graph->add_port(port, true);
+    if(jack_port_flags(port) & JackPortIsInput){
+     graph->m_new_ports.insert(jack_port_name(port));
+    }
+    return;
+   }
+   std::string name = graph->name_of(id);
+   graph->m_names.erase(id);
+   if(name.empty()){ //a port that was there before load() and is already gone - drop whatever no longer exists
+    graph->forget_missing();
+    return;
+   }
+   graph->m_new_ports.erase(name);
+   graph->forget_port(name);
+  }
+
+  //Remove a port and its connections from the cache
+  void forget_port(const std::string &name){
+   auto found = m_ports.find(name);
+   if(found == m_ports.end()){
+    return;
+   }
+   for (const std::string &peer : found->second.connections){ //JACK may not report these disconnections separately
+    auto other = m_ports.find(peer);
+    if(other != m_ports.end()){
+     other->second.connections.erase(name);
+    }
+   }
+   m_ports.erase(found);
+  }
+
+  void forget_missing(void){
+   std::vector<std::string> missing;
+   for (auto &entry : m_ports){
+    if(jack_port_by_name(m_client, entry.first.c_str()) == NULL){
+     missing.push_back(entry.first);
+    }
+   }
+   for (const std::string &name : missing){
+    m_new_ports.erase(name);
+    forget_port(name);
+   }
+  }
+
+  static void connect_callback(jack_port_id_t a, jack_port_id_t b, int connect, void *arg){
+   jack_port_graph *graph = static_cast<jack_port_graph*>(arg);
+   std::lock_guard<std::mutex> lock(graph->m_lock);
+   std::string name_a = graph->name_of(a);
+   std::string name_b = graph->name_of(b);
+   auto port_a = graph->m_ports.find(name_a);
+   auto port_b = graph->m_ports.find(name_b);
+   if((port_a == graph->m_ports.end()) || (port_b == graph->m_ports.end())){
+    return;
+   }
+   if(connect){
+    port_a->second.connections.insert(name_b);
+    port_b->second.connections.insert(name_a);
+   }else{
+    port_a->second.connections.erase(name_b);
+    port_b->second.connections.erase(name_a);
+   }
+  }
+};
+
+#endif
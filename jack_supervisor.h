@@ -0,0 +1,115 @@
+/*
+ * Reconnecting JACK clients after the server restarts
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef JACK_SUPERVISOR_H
+#define JACK_SUPERVISOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <jack/jack.h>
+
+/**
+ * Keeps track of a JACK client's state across a server restart. The
+ * shutdown callback marks the client lost; the owner's supervising thread
+ * then closes it, reopens it with backoff, re-registers its ports and puts
+ * back the connections remembered before the server went away.
+ */
+struct jack_supervisor {
+ jack_supervisor(void): m_lost(false), m_restarts(0), m_last_recovery_ms(0){}
+ public:
+  //From the JACK shutdown callback - only flags the loss, the client is closed by the supervising thread
+  void lost(void){
+   if(!m_lost.exchange(true)){
+    m_lost_at = std::chrono::steady_clock::now();
+   }
+  }
+
+  bool is_lost(void){ return m_lost.load(); }
+
+  //Snapshot the connections of our ports, by short name, so they can be restored on a new client
+  void remember(jack_client_t *client, jack_port_t *const *ports, size_t count){
+   std::map<std::string, std::vector<std::string>> connections;
+   for (size_t i = 0; i < count; i++){
+    if(ports[i] == NULL){
+     continue;
+    }
+    std::vector<std::string> &peers = connections[jack_port_short_name(ports[i])];
+    const char **names = jack_port_get_all_connections(client, ports[i]);
+    for (size_t n = 0; names && names[n]; n++){
+     peers.push_back(names[n]);
+    }
+    jack_free(names);
+   }
+   std::lock_guard<std::mutex> lock(m_lock);
+   m_connections.swap(connections);
+  }
+
+  void restore(jack_client_t *client, jack_port_t *const *ports, size_t count){
+   std::lock_guard<std::mutex> lock(m_lock);
+   for (size_t i = 0; i < count; i++){
+    if(ports[i] == NULL){
+     continue;
+    }
+    auto found = m_connections.find(jack_port_short_name(ports[i]));
+    if(found == m_connections.end()){
+     continue;
+    }
+    bool output = (jack_port_flags(ports[i]) & JackPortIsOutput) != 0;
+    for (const std::string &peer : found->second){ //peers that have not come back yet are skipped
+     int result = output ? jack_connect(client, jack_port_name(ports[i]), peer.c_str()) : jack_connect(client, peer.c_str(), jack_port_name(ports[i]));
+     if(result && (result != EEXIST)){
+      fprintf(stderr, "cannot restore connection %s - %s\n", jack_port_name(ports[i]), peer.c_str());
+     }
+    }
+   }
+  }
+
+  /**
+   * Open the client again, waiting 100ms between tries and doubling up to
+   * 5s while the server is down. Returns NULL if exiting becomes true.
+   * server_name picks a named server, NULL or "" for the default one.
+   */
+  jack_client_t* reopen(const char *client_name, std::atomic<bool> &exiting, const char *server_name = NULL){
+   int backoff_ms = 100;
+   bool named = server_name && server_name[0];
+   while (!exiting){
+    jack_status_t status;
+    jack_client_t *client = named ? jack_client_open(client_name, (jack_options_t)(JackNoStartServer | JackServerName), &status, server_name) : jack_client_open(client_name, JackNoStartServer, &status, NULL);
+    if(client){
+     return client;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+    backoff_ms = std::min(backoff_ms * 2, 5000);
+   }
+   return NULL;
+  }
+
+  //The client is running again - record how long it was gone
+  void recovered(void){
+   m_last_recovery_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_lost_at).count();
+   m_restarts++;
+   m_lost = false;
+   printf("JACK connection restored after %llums\n", (unsigned long long)m_last_recovery_ms.load());
+  }
+
+  std::atomic<uint64_t> m_restarts; //server restarts survived
+  std::atomic<uint64_t> m_last_recovery_ms; //from losing the server to running again
+ private:
+  std::atomic<bool> m_lost;
+  std::chrono::steady_clock::time_point m_lost_at;
+  std::mutex m_lock;
+  std::map<std::string, std::vector<std::string>> m_connections; //our port short name to the ports it was connected to
+};
+
+#endif
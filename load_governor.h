@@ -0,0 +1,108 @@
+/*
+ * Shedding non-essential work while the JACK server is overloaded
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef LOAD_GOVERNOR_H
+#define LOAD_GOVERNOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <algorithm>
+#include <jack/jack.h>
+
+enum load_level {
+  load_level_full = 0, //everything at its configured rate and quality
+  load_level_reduced,  //one step down
+  load_level_minimal   //only what keeps audio running
+};
+
+/**
+ * Watches jack_cpu_load() and our own process callback time and steps
+ * non-essential work down a level when the load stays high, then back up
+ * one level at a time once it has stayed low for a while. The owners read
+ * level() and decide what a level means for them. record_cycle() is RT
+ * safe; sample() runs on a supervising thread a few times a second.
+ */
+struct load_governor {
+ load_governor(void): m_level(load_level_full), m_cycle_max_us(0), m_cycle_us(0), m_cycles(0), m_cpu_load(0.0f), m_callback_load(0.0f), m_changes(0){}
+ public:
+  static constexpr float high_load = 75.0f; //percent of the period - above this the load is high
+  static constexpr float low_load = 50.0f; //below this it is low again
+  static constexpr int degrade_after_ms = 2000; //high load for this long steps down a level
+  static constexpr int restore_after_ms = 10000; //low load for this long steps back up
+
+  //From the process callback - how long one cycle took
+  void record_cycle(uint64_t us){
+   m_cycle_us.fetch_add(us, std::memory_order_relaxed);
+   m_cycles.fetch_add(1, std::memory_order_relaxed);
+   uint64_t max_us = m_cycle_max_us.load(std::memory_order_relaxed);
+   while ((us > max_us) && !m_cycle_max_us.compare_exchange_weak(max_us, us, std::memory_order_relaxed)){
+   }
+  }
+
+  /**
+   * Take a load reading, interval_ms after the last one. Returns true when
+   * the level changed. name prefixes the log line.
+   */
+  bool sample(jack_client_t *client, int interval_ms, const char *name){
+   float cpu_load = jack_cpu_load(client);
+   uint64_t cycle_max_us = m_cycle_max_us.exchange(0, std::memory_order_relaxed);
+   uint64_t cycle_us = m_cycle_us.exchange(0, std::memory_order_relaxed);
+   uint64_t cycles = m_cycles.exchange(0, std::memory_order_relaxed);
+   jack_nframes_t rate = jack_get_sample_rate(client);
+   double period_us = (rate > 0) ? jack_get_buffer_size(client) * 1000000.0 / rate : 0.0;
+   float callback_load = (period_us > 0.0) ? (float)(cycle_max_us * 100.0 / period_us) : 0.0f; //our worst callback as a share of the period
+   m_cpu_load = cpu_load;
+   m_callback_load = callback_load;
+   bool high = (cpu_load > high_load) || (callback_load > high_load);
+   bool low = (cpu_load < low_load) && (callback_load < low_load);
+   m_high_ms = high ? m_high_ms + interval_ms : 0;
+   m_low_ms = low ? m_low_ms + interval_ms : 0;
+   int level = m_level.load();
+   int next = level;
+   if((m_high_ms >= degrade_after_ms) && (level < load_level_minimal)){
+    next = level + 1;
+   }else if((m_low_ms >= restore_after_ms) && (level > load_level_full)){
+    next = level - 1;
+   }
+   if(next == level){
+    return false;
+   }
+   m_high_ms = 0; //a further step needs its own sustained reading
+   m_low_ms = 0;
+   m_level = next;
+   m_changes++;
+   printf("%s: %s to %s - DSP load %.1f%%, process callback max %lluus avg %lluus of a %.0fus period (%.1f%%)\n", name, (next > level) ? "load high, degrading" : "load low, restoring",
+          level_name(next), cpu_load, (unsigned long long)cycle_max_us, (unsigned long long)(cycles ? cycle_us / cycles : 0), period_us, callback_load);
+   return true;
+  }
+
+  int level(void){ return m_level.load(std::memory_order_relaxed); }
+
+  static const char* level_name(int level){
+   static const char *names[] = { "full", "reduced", "minimal" };
+   return names[std::min(std::max(level, 0), 2)];
+  }
+
+  std::string stats_json(void){
+   return "\"load_level\":\""+std::string(level_name(level()))+"\",\"cpu_load\":\""+std::to_string(m_cpu_load.load())+"\",\"callback_load\":\""+std::to_string(m_callback_load.load())+
+          "\",\"load_changes\":\""+std::to_string(m_changes.load())+"\"";
+  }
+
+ private:
+  std::atomic<int> m_level;
+  std::atomic<uint64_t> m_cycle_max_us; //since the last sample
+  std::atomic<uint64_t> m_cycle_us;
+  std::atomic<uint64_t> m_cycles;
+  std::atomic<float> m_cpu_load; //last readings, for reporting
+  std::atomic<float> m_callback_load;
+  std::atomic<uint64_t> m_changes;
+  int m_high_ms = 0; //how long the load has been high or low
+  int m_low_ms = 0;
+};
+
+#endif
@@ -21,12 +21,25 @@
 #include "mjson.h"
 #include <thread>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
 
 #include <getopt.h> 
 #include <condition_variable>
+#include <mutex>
 
 #include <Processing.NDI.Lib.h>
 #include <jack/jack.h>
+#include "audio_kernels.h"
+#include "spsc_queue.h"
+#include "jack_supervisor.h"
+#include "jack_port_graph.h"
+#include "load_governor.h"
+#include "rt_setup.h"
+#include "rt_check.h"
+#include "trace.h"
 
 NDIlib_find_create_t NDI_find_create_desc; /* Default settings for NDI find */
 NDIlib_find_instance_t pNDI_find;
@@ -35,7 +48,11 @@ int stream_info[3]; //stream info for the NDI stream
 const NDIlib_source_t* p_sources = NULL;
 struct mg_mgr mgr;   
 bool auto_connect_jack_ports = true;
-float main_volume = 0.5f; //set to half volume by default
+float main_volume = 0.5f; //set to half volume by default - receivers get it through their parameter queue
+int mix_buses = 0; //number of internal mixer bus outputs - 0 disables the mixer
+int synthetic_sources = 0; //stand-in sources listed instead of the finder's, for measuring the catalog on a large network
+std::vector<std::string> jack_servers = { "" }; //JACK servers receivers can play to, "" for the default server
+rt_setup rt_threads; //CPUs and priorities of the control and NDI threads, from --affinity
 
 //Function Definitions
 int process_callback(jack_nframes_t x, void *p);
@@ -44,182 +61,2033 @@ bool get_ndi_info(const char* source);
 
 
 
+enum param_type {
+  param_main_gain = 0, //value: gain applied to every receiver
+  param_gain,          //value: receiver gain
+  param_mute,          //value: 1 mutes the receiver
+  param_solo_mute,     //value: 1 mutes the receiver because another receiver is soloed
+  param_channel_gain,  //channel, value: gain of one channel
+  param_channel_mute,  //channel, value: 1 mutes one channel
+  param_channel_solo,  //channel, value: 1 solos one channel of this receiver
+  param_sync_delay,    //value: samples the sync group holds this receiver back
+  param_delay          //value: samples of delay set by the user
+};
+
+struct param_command {
+  int type;
+  int channel;
+  float value;
+};
+
+/**
+ * Hands a receiver's post-gain audio to the internal mixer. The receiver's
+ * process callback writes a period per cycle and the mixer's process
+ * callback reads a period per cycle, so each channel is a lock-free single
+ * producer/single consumer ring of samples.
+ */
+struct mix_feed {
+ mix_feed(int channel_count); //constructor
+ ~mix_feed(void); //destructor
+ public:
+  void write(int channel, const float *src, jack_nframes_t nframes); //receiver RT thread
+  void commit(jack_nframes_t nframes);
+  bool begin_read(jack_nframes_t nframes); //mixer RT thread
+  const float* read_block(int channel, jack_nframes_t nframes, float *scratch);
+  void consume(jack_nframes_t nframes);
+  bool rt_ready = false; //a whole period was available at the start of this mixer cycle
+ private:
+  static const uint32_t ring_size = 8192; //samples per channel - a power of two
+  int num_channels;
+  float *m_data;
+  std::atomic<uint32_t> m_write; //free running sample counters
+  std::atomic<uint32_t> m_read;
+};
+
+mix_feed::mix_feed(int channel_count): num_channels(channel_count), m_write(0), m_read(0){
+  m_data = (float*)calloc(ring_size * num_channels, sizeof(float));
+  rt_prefault(m_data, ring_size * num_channels * sizeof(float)); //calloc can hand back untouched zero pages
+}
+
+mix_feed::~mix_feed(void){
+  free(m_data);
+}
+
+void mix_feed::write(int channel, const float *src, jack_nframes_t nframes){
+  uint32_t write = m_write.load(std::memory_order_relaxed);
+  if(channel >= num_channels){ //output added by a later format change - the mixer only sees the original channels
+   return;
+  }
+  if(write - m_read.load(std::memory_order_acquire) + nframes > ring_size){ //mixer is not reading this feed - drop
+   return;
+  }
+  float *p_ch = m_data + channel * ring_size;
+  uint32_t start = write & (ring_size - 1);
+  uint32_t first = std::min(nframes, ring_size - start);
+  memcpy(p_ch + start, src, first * sizeof(float));
+  memcpy(p_ch, src + first, (nframes - first) * sizeof(float));
+}
+
+void mix_feed::commit(jack_nframes_t nframes){
+  uint32_t write = m_write.load(std::memory_order_relaxed);
+  if(write - m_read.load(std::memory_order_acquire) + nframes > ring_size){
+   return;
+  }
+  m_write.store(write + nframes, std::memory_order_release);
+}
+
+bool mix_feed::begin_read(jack_nframes_t nframes){
+  uint32_t write = m_write.load(std::memory_order_acquire);
+  uint32_t read = m_read.load(std::memory_order_relaxed);
+  if(write - read > 3 * nframes){ //more than the graph order jitter needs - skip ahead to keep latency down
+   read = write - 2 * nframes;
+   m_read.store(read, std::memory_order_release);
+  }
+  rt_ready = (write - read >= nframes);
+  return rt_ready;
+}
+
+const float* mix_feed::read_block(int channel, jack_nframes_t nframes, float *scratch){
+  if(channel >= num_channels){
+   return NULL;
+  }
+  const float *p_ch = m_data + channel * ring_size;
+  uint32_t start = m_read.load(std::memory_order_relaxed) & (ring_size - 1);
+  if(start + nframes <= ring_size){ //contiguous - mix straight from the ring
+   return p_ch + start;
+  }
+  uint32_t first = ring_size - start;
+  memcpy(scratch, p_ch + start, first * sizeof(float));
+  memcpy(scratch + first, p_ch, (nframes - first) * sizeof(float));
+  return scratch;
+}
+
+void mix_feed::consume(jack_nframes_t nframes){
+  if(rt_ready){
+   m_read.store(m_read.load(std::memory_order_relaxed) + nframes, std::memory_order_release);
+  }
+}
+
+struct layout_term {
+  int source_channel; //NDI channel
+  float coefficient;
+};
+
+/**
+ * Work out which JACK outputs a receiver registers and how each is made
+ * from the NDI channels. The spec is one of:
+ *   ""             every NDI channel on its own output
+ *   "2,3"          only the listed NDI channels (counting from 0)
+ *   "5.1"          5.1 (L R C LFE Ls Rs) downmixed to stereo
+ *   "mono"         every NDI channel summed to one output
+ *   "m:1,0;0,1"    explicit matrix, one row of NDI channel gains per output
+ * Returns how many NDI channels have to be captured.
+ */
+static int parse_channel_layout(const std::string &spec, int source_channels, std::vector<std::vector<layout_term>> &outputs){
+  outputs.clear();
+  if(spec == "5.1"){
+   const float centre = 0.7071f; //-3dB for the centre and surrounds
+   outputs.push_back({ { 0, 1.0f }, { 2, centre }, { 4, centre } });
+   outputs.push_back({ { 1, 1.0f }, { 2, centre }, { 5, centre } });
+  }else if(spec == "mono"){
+   std::vector<layout_term> row;
+   for (int channel = 0; channel < source_channels; channel++){
+    row.push_back({ channel, 1.0f / source_channels });
+   }
+   outputs.push_back(row);
+  }else if(spec.compare(0, 2, "m:") == 0){
+   std::string rows = spec.substr(2);
+   size_t row_start = 0;
+   while(row_start <= rows.size()){
+    size_t row_end = rows.find(';', row_start);
+    if(row_end == std::string::npos){
+     row_end = rows.size();
+    }
+    std::string row_spec = rows.substr(row_start, row_end - row_start);
+    std::vector<layout_term> row;
+    size_t start = 0;
+    for (int channel = 0; start < row_spec.size(); channel++){
+     size_t end = row_spec.find(',', start);
+     if(end == std::string::npos){
+      end = row_spec.size();
+     }
+     float coefficient = atof(row_spec.substr(start, end - start).c_str());
+     if(coefficient != 0.0f){
+      row.push_back({ channel, coefficient });
+     }
+     start = end + 1;
+    }
+    outputs.push_back(row);
+    row_start = row_end + 1;
+   }
+  }else if(spec != ""){
+   size_t start = 0;
+   while(start < spec.size()){
+    size_t end = spec.find(',', start);
+    if(end == std::string::npos){
+     end = spec.size();
+    }
+    outputs.push_back({ { atoi(spec.substr(start, end - start).c_str()), 1.0f } });
+    start = end + 1;
+   }
+  }else{
+   for (int channel = 0; channel < source_channels; channel++){
+    outputs.push_back({ { channel, 1.0f } });
+   }
+  }
+  int capture_channels = 0;
+  for (std::vector<layout_term> &row : outputs){ //drop terms the source does not have
+   row.erase(std::remove_if(row.begin(), row.end(), [source_channels](const layout_term &term){ return (term.source_channel < 0) || (term.source_channel >= source_channels); }), row.end());
+   for (const layout_term &term : row){
+    capture_channels = std::max(capture_channels, term.source_channel + 1);
+   }
+  }
+  return std::max(capture_channels, 1);
+}
+
+/**
+ * One NDI connection and framesync shared by every receiver of the same
+ * source on the same JACK server. The first receiver to run in a JACK cycle
+ * captures the period and the rest read the same frame, so adding outputs
+ * for a source costs no extra network bandwidth or decoding. Receivers of
+ * one server run one after another from its client's process callback, so
+ * the capture needs no lock. Each server runs on its own clock and the
+ * framesync resamples to the clock that pulls it, so receivers of a source
+ * on another server get their own connection.
+ */
+struct shared_receiver {
+ public:
+  static shared_receiver* acquire(const char *source, const std::string &server_name); //control thread - creates the connection for the first user
+  void release(void);
+  void set_capture_channels(const void *user, int channels); //NDI channels a receiver's layout reads, 0 when it leaves
+  const NDIlib_audio_frame_v3_t* capture(jack_nframes_t cycle, jack_nframes_t nframes, int sample_rate, bool *starved); //RT
+  std::string m_ndi_name;
+  std::string m_server_name; //JACK server whose cycles pull the framesync
+  std::atomic<int> m_source_channels; //format the framesync last reported, 0 if unknown
+  std::atomic<int> m_source_rate;
+ private:
+  shared_receiver(const char *source);
+  ~shared_receiver(void);
+  NDIlib_recv_instance_t m_pNDI_recv;
+  NDIlib_framesync_instance_t m_pNDI_framesync;
+  NDIlib_audio_frame_v3_t m_frame; //this cycle's period, held until the next cycle captures
+  bool m_have_frame = false;
+  jack_nframes_t m_cycle = 0; //JACK frame time the held frame was captured for
+  bool m_starved = false; //the held frame was padded by the framesync
+  bool m_receiving = false; //audio has arrived at least once, so an empty framesync queue is a dropout
+  int m_probe_countdown = 0; //cycles until the source format is checked again
+  std::atomic<int> m_capture_channels; //most channels any user reads
+  std::mutex m_users_lock;
+  std::vector<std::pair<const void*, int>> m_users; //each user's capture channels
+  int m_references = 0;
+  static std::vector<shared_receiver*> s_receivers; //every open connection, control thread only
+};
+
+std::vector<shared_receiver*> shared_receiver::s_receivers;
+
+shared_receiver::shared_receiver(const char *source): m_ndi_name(source), m_source_channels(0), m_source_rate(0), m_capture_channels(1){
+  NDIlib_recv_create_v3_t recv_create_desc;
+  recv_create_desc.source_to_connect_to = source;
+  recv_create_desc.bandwidth = NDIlib_recv_bandwidth_audio_only; //specify receiving audio frames only
+  recv_create_desc.p_ndi_recv_name = "NDI Receiver";
+  rt_thread_scope scope(rt_threads, "ndi"); //the SDK's receive and framesync threads start with the NDI placement
+  m_pNDI_recv = NDIlib_recv_create_v3(&recv_create_desc);
+  assert(m_pNDI_recv);
+
+  // Use a frame-synchronizer to ensure that the audio is dynamically resampled
+  m_pNDI_framesync = NDIlib_framesync_create(m_pNDI_recv); //starts in its own thread
+}
+
+shared_receiver::~shared_receiver(void){
+  if(m_have_frame){
+   NDIlib_framesync_free_audio_v2(m_pNDI_framesync, &m_frame);
+  }
+  NDIlib_framesync_destroy(m_pNDI_framesync);
+  NDIlib_recv_destroy(m_pNDI_recv);
+}
+
+shared_receiver* shared_receiver::acquire(const char *source, const std::string &server_name){
+  for (shared_receiver *shared : s_receivers){
+   if((shared->m_ndi_name == source) && (shared->m_server_name == server_name)){
+    shared->m_references++;
+    printf("Sharing NDI connection to %s (%d receivers)\n", source, shared->m_references);
+    return shared;
+   }
+  }
+  trace_scope trace(trace_coarse, "ndi connect");
+  shared_receiver *shared = new shared_receiver(source);
+  shared->m_server_name = server_name;
+  shared->m_references = 1;
+  s_receivers.push_back(shared);
+  return shared;
+}
+
+//Called once the receiver has left its JACK client, so nothing can still be capturing for it
+void shared_receiver::release(void){
+  if(--m_references > 0){
+   return;
+  }
+  s_receivers.erase(std::find(s_receivers.begin(), s_receivers.end(), this));
+  delete this;
+}
+
+void shared_receiver::set_capture_channels(const void *user, int channels){
+  std::lock_guard<std::mutex> lock(m_users_lock);
+  auto found = std::find_if(m_users.begin(), m_users.end(), [user](const std::pair<const void*, int> &entry){ return entry.first == user; });
+  if(found != m_users.end()){
+   m_users.erase(found);
+  }
+  if(channels > 0){
+   m_users.push_back(std::make_pair(user, channels));
+  }
+  int most = 1;
+  for (const std::pair<const void*, int> &entry : m_users){
+   most = std::max(most, entry.second);
+  }
+  m_capture_channels.store(most, std::memory_order_relaxed);
+}
+
+/**
+ * The period for the JACK cycle that started at frame time cycle. The first
+ * caller in a cycle frees the previous frame and captures a new one; JACK
+ * cycles never overlap, so the frame stays valid until every receiver of
+ * this cycle has finished with it.
+ */
+const NDIlib_audio_frame_v3_t* shared_receiver::capture(jack_nframes_t cycle, jack_nframes_t nframes, int sample_rate, bool *starved){
+  if(!m_have_frame || (cycle != m_cycle)){
+   trace_scope trace(trace_coarse, "framesync capture");
+   if(m_have_frame){
+    NDIlib_framesync_free_audio_v2(m_pNDI_framesync, &m_frame);
+   }
+   if(--m_probe_countdown <= 0){ //a zero sample capture reports the incoming format without taking audio
+    m_probe_countdown = std::max(1, (int)(sample_rate / 4 / nframes)); //four times a second
+    NDIlib_audio_frame_v3_t probe;
+    NDIlib_framesync_capture_audio_v2(m_pNDI_framesync, &probe, 0, 0, 0);
+    m_source_channels.store(probe.no_channels, std::memory_order_relaxed);
+    m_source_rate.store(probe.sample_rate, std::memory_order_relaxed);
+    NDIlib_framesync_free_audio_v2(m_pNDI_framesync, &probe);
+   }
+   m_starved = (NDIlib_framesync_audio_queue_depth(m_pNDI_framesync) < (int)nframes) && m_receiving; //framesync will pad with silence - the network fell behind
+   NDIlib_framesync_capture_audio_v2(m_pNDI_framesync, &m_frame, sample_rate, m_capture_channels.load(std::memory_order_relaxed), nframes); //only the channels the outputs use
+   m_receiving = m_receiving || ((m_frame.p_data != NULL) && (m_frame.no_samples > 0));
+   m_have_frame = true;
+   m_cycle = cycle;
+  }
+  *starved = m_starved;
+  return &m_frame;
+}
+
+/**
+ * Everything the process callback needs to turn the NDI channels into JACK
+ * outputs. When the source changes format the receiver builds a new one off
+ * the RT thread and the process callback swaps it in at a cycle boundary.
+ */
+struct receiver_layout {
+  int source_channels = 0; //NDI channels the layout was built for
+  int num_channels = 0; //JACK outputs
+  int num_capture_channels = 0; //NDI channels pulled from the framesync
+  std::vector<std::vector<layout_term>> outputs; //how each output is made from the NDI channels
+  std::vector<jack_port_t*> ports; //one per output - unchanged outputs keep their port and connections
+  std::vector<float> channel_gain; //per output parameter state, owned by the RT thread while active
+  std::vector<char> channel_mute;
+  std::vector<char> channel_solo;
+  std::vector<float> current_gain; //gain each channel ended the last cycle on
+  std::vector<float> target_gain; //gain each channel ramps to this cycle
+  std::vector<float> delay_data; //per output delay line of delay_size samples
+  uint32_t delay_size = 0; //a power of two
+  uint32_t max_delay = 0; //longest delay in samples - leaves room for a whole period
+};
+
+static const int max_delay_ms = 500; //longest receiver delay
+static const uint32_t max_period = 8192; //largest JACK period the delay lines allow for
+
+//Copy n samples into a delay line at start, wrapping at size (a power of two)
+static inline void delay_write(float *line, uint32_t size, uint32_t start, const float *src, uint32_t n){
+  uint32_t first = std::min(n, size - start);
+  memcpy(line + start, src, first * sizeof(float));
+  memcpy(line, src + first, (n - first) * sizeof(float));
+}
+
+static inline void delay_read(float *dst, const float *line, uint32_t size, uint32_t start, uint32_t n){
+  uint32_t first = std::min(n, size - start);
+  memcpy(dst, line + start, first * sizeof(float));
+  memcpy(dst + first, line, (n - first) * sizeof(float));
+}
+
+struct receive_audio;
+
+/**
+ * The JACK client for one JACK server. Every receiver that plays to the
+ * server puts its ports on this client and the client's process callback
+ * runs them one after another, so one ndi2jack can feed a server per sound
+ * card while discovery, the web server and the NDI connections are shared.
+ * The client also follows its server for the receivers: it keeps the port
+ * graph, passes on format changes and reconnects after a restart.
+ */
+struct jack_server_client {
+ public:
+  static jack_server_client* acquire(const std::string &server_name, const char *client_name); //control thread - opens the client for the first receiver
+  void release(void);
+  void add(receive_audio *receiver); //control thread - runs the receiver from the next cycle on
+  void remove(receive_audio *receiver); //control thread - returns once the RT thread has stopped running the receiver
+  int process(jack_nframes_t nframes);
+  bool is_lost(void){ return m_supervisor.is_lost(); }
+  std::string unique_prefix(const std::string &source);
+  std::string m_server_name; //"" for the default server
+  std::string m_client_name; //name JACK gave us, reused when reconnecting so connections match
+  jack_client_t *m_client; //swapped on reconnect - hold m_client_lock to use it off the RT thread
+  std::mutex m_client_lock;
+  std::atomic<jack_nframes_t> m_sample_rate; //0 until the server has been reached
+  jack_port_graph m_graph; //ports and connections of the whole graph, for the connection rules
+  jack_supervisor m_supervisor;
+  load_governor m_governor; //DSP load of the server and our process callback
+  static int load_level(void); //control thread - the highest level of any server
+ private:
+  jack_server_client(const std::string &server_name, const char *client_name);
+  ~jack_server_client(void);
+  bool open(void);
+  void sample_rate_changed(jack_nframes_t rate);
+  void publish(void);
+  void reconnect(void);
+  void supervise(void);
+  std::mutex m_receivers_lock; //held while m_receivers changes, so the JACK callbacks see whole lists
+  std::vector<receive_audio*> m_receivers;
+  std::vector<receive_audio*> *rt_receivers; //receivers the process callback runs
+  std::atomic<std::vector<receive_audio*>*> m_pending; //built by the control thread, taken by the RT thread
+  std::atomic<std::vector<receive_audio*>*> m_retired; //handed back by the RT thread after a swap
+  int m_references = 0;
+  std::thread m_supervisor_thread;
+  std::atomic<bool> m_exit;
+  std::atomic<bool> m_freewheel; //cycles run back to back - not a load reading
+  static std::vector<jack_server_client*> s_servers; //every open client, control thread only
+  static void jack_shutdown(void *arg); //This is called when JACK is shutdown
+  static int sample_rate_callback(jack_nframes_t nframes, void *arg);
+  static int buffer_size_callback(jack_nframes_t nframes, void *arg);
+  static void latency_callback(jack_latency_callback_mode_t mode, void *arg);
+  static void freewheel_callback(int starting, void *arg);
+};
+
+std::vector<jack_server_client*> jack_server_client::s_servers;
+
 struct receive_audio {
- receive_audio(const char* source, const char *client_name="NDI_recv", int channel_count = 2); //constructor
+ receive_audio(const char* source, const char *client_name="NDI_recv", int channel_count = 2, const char *layout = "", const char *rules = "", const char *server_name = ""); //constructor
  ~receive_audio(void); //destructor 
  public:
   int process(jack_nframes_t nframes);
- private:	
-	NDIlib_recv_instance_t m_pNDI_recv; // Create the receiver
-  NDIlib_framesync_instance_t m_pNDI_framesync; //NDI framesync
-  NDIlib_audio_frame_v3_t audio_frame;
-  jack_port_t **out_ports;
-  jack_default_audio_sample_t *out;
-  jack_default_audio_sample_t *p_ch;
+  void set_param(int type, int channel, float value); //called from the control thread
+  float m_gain = 1.0f; //control thread copies of the receiver parameters, reported to the web page
+  bool m_mute = false;
+  bool m_solo = false;
+  mix_feed *m_mix_feed = NULL; //copy of the output for the internal mixer, when it is enabled
+  std::string m_layout; //channel subset or downmix spec, see parse_channel_layout()
+  std::string m_connect_rules; //control thread copy of the connection rules, see parse_connect_rules()
+  std::string m_server_name; //JACK server the outputs are on, "" for the default
+  bool set_connect_rules(const std::string &rules);
+  std::string stats_json(void);
+  int source_channels(void){ return m_shared->m_source_channels.load(); } //0 until audio has arrived
+  bool timestamp_offset(int64_t *offset_us);
+  int delay_samples(int64_t delay_us){ return (int)((delay_us * (int64_t)jack_sample_rate) / 1000000); }
+  float delay_ms(void){ return m_delay_samples * 1000.0f / jack_sample_rate; }
+  void set_delay(int samples);
+  int m_delay_samples = 0; //control thread copy of the user delay
+  int m_sync_group = 0; //receivers with the same group are aligned by NDI timestamp, 0 for none
+  int64_t m_sync_delay_us = 0; //control thread state of the sync group alignment
+  double m_sync_age_us = 0.0; //smoothed time from NDI timestamp to the JACK cycle
+  double m_sync_jitter_us = 0.0;
+  bool m_sync_valid = false;
+  void update_latency(void);
+  //From the server client, on its threads
+  void sample_rate_changed(jack_nframes_t rate);
+  void publish_latency(void);
+  void set_freewheel(bool starting);
+  void ports_appeared(const std::set<std::string> &ports);
+  void collect_ports(std::vector<jack_port_t*> &ports);
+  bool register_ports(std::vector<jack_port_t*> &ports); //false if a port could not be registered
+  std::string m_port_prefix; //our ports are "<prefix> output_N" on the server's client
+ private:	
+  shared_receiver *m_shared; //NDI connection, shared with other receivers of the same source
+  jack_server_client *m_server; //client of our JACK server, shared with its other receivers
+  jack_default_audio_sample_t *out;
+  jack_default_audio_sample_t *p_ch;
+  std::atomic<jack_nframes_t> jack_sample_rate; //written by the layout thread, the RT thread reads it
+  std::atomic<jack_nframes_t> m_pending_sample_rate; //new rate from the sample rate callback, 0 if none
+  spsc_queue<param_command, 256> m_commands; //parameter changes from the control thread, applied at the start of a cycle
+  void apply_commands(void);
+  void update_targets(void);
+  float rt_main_gain; //parameter state owned by the RT thread
+  float rt_gain = 1.0f;
+  bool rt_mute = false;
+  bool rt_solo_mute = false;
+  uint32_t rt_sync_delay = 0; //samples
+  uint32_t rt_delay = 0; //samples
+  uint32_t rt_delay_pos = 0; //free running write position of the delay lines
+  uint32_t rt_delay_played = 0; //delay the last cycle read at - a change crossfades from it
+  std::vector<float> m_fade; //two max_period blocks for the old and new delay reads of a crossfade
+  std::atomic<int64_t> m_timestamp_offset_us; //sender timestamp less JACK time at the start of the last cycle, INT64_MIN if unknown
+  receiver_layout *rt_layout = NULL; //layout the process callback is using
+  receiver_layout *m_active_layout = NULL; //layout thread copy of rt_layout, updated once a swap is seen
+  std::atomic<receiver_layout*> m_pending_layout; //built by the layout thread, taken by the RT thread
+  std::atomic<receiver_layout*> m_retired_layout; //handed back by the RT thread after a swap
+  void adopt_layout(receiver_layout *next);
+  receiver_layout* build_layout(int source_channels);
+  bool change_layout(int source_channels);
+  std::string port_name(int channel){ return m_port_prefix + " output_" + std::to_string(channel); }
+  void auto_connect(receiver_layout *layout, int first_channel, const std::set<std::string> &targets = std::set<std::string>());
+  std::mutex m_rules_lock;
+  std::vector<connect_rule> m_rules; //parsed m_connect_rules, applied by the layout thread
+  std::atomic<bool> m_rules_changed;
+  std::mutex m_new_ports_lock;
+  std::set<std::string> m_new_ports; //input ports registered since the layout thread last looked
+  std::atomic<bool> m_freewheel; //JACK is running faster than real time - no NDI is pulled
+  std::atomic<uint64_t> m_freewheel_frames; //processed in the current or last freewheel run
+  std::atomic<uint64_t> m_freewheel_us; //time spent in the process callback for them
+  NDIlib_audio_frame_v3_t m_silent_frame; //rendered instead of NDI audio while freewheeling
+  void layout_thread(void);
+  std::thread m_layout_thread;
+  std::mutex m_ports_lock; //held while m_active_layout or its ports change, so the server client's threads see whole layouts
+  std::atomic<jack_nframes_t> m_latency_min; //capture latency published on the outputs
+  std::atomic<jack_nframes_t> m_latency_max;
+  std::atomic<bool> m_latency_changed; //the layout thread asks JACK to recompute the graph latencies
+  std::atomic<uint64_t> m_format_changes; //layouts rebuilt because the source changed channel count
+  std::atomic<uint64_t> m_underruns; //framesync returned fewer samples than the JACK period
+  std::atomic<uint64_t> m_overruns; //framesync returned more samples than the JACK period
+  std::atomic<uint64_t> m_starved; //framesync queue ran dry and was padded with silence
+  std::atomic<uint64_t> m_last_underrun_us; //JACK clock time of the last event of each kind
+  std::atomic<uint64_t> m_last_overrun_us;
+  std::atomic<uint64_t> m_last_starved_us;
+	std::atomic<bool> m_exit;	// Are we ready to exit	
+};
+
+/**
+ * Receiver counters as a JSON object. Event times are converted from the
+ * JACK clock to milliseconds since the epoch so they can be lined up with
+ * network logs.
+ */
+std::string receive_audio::stats_json(void){
+  int64_t wall_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t jack_offset_us = wall_us - (int64_t)jack_get_time();
+  auto event_ms = [jack_offset_us](uint64_t jack_us){ return std::to_string((jack_us == 0) ? 0 : ((int64_t)jack_us + jack_offset_us) / 1000); };
+  return "{\"underruns\":\""+std::to_string(m_underruns.load())+"\",\"last_underrun_ms\":\""+event_ms(m_last_underrun_us.load())+
+         "\",\"overruns\":\""+std::to_string(m_overruns.load())+"\",\"last_overrun_ms\":\""+event_ms(m_last_overrun_us.load())+
+         "\",\"starved\":\""+std::to_string(m_starved.load())+"\",\"last_starved_ms\":\""+event_ms(m_last_starved_us.load())+
+         "\",\"source_channels\":\""+std::to_string(m_shared->m_source_channels.load())+"\",\"source_rate\":\""+std::to_string(m_shared->m_source_rate.load())+
+         "\",\"format_changes\":\""+std::to_string(m_format_changes.load())+"\",\"sync_group\":\""+std::to_string(m_sync_group)+
+         "\",\"sync_delay_us\":\""+std::to_string(m_sync_delay_us)+"\",\"delay_samples\":\""+std::to_string(m_delay_samples)+
+         "\",\"freewheel\":\""+std::to_string(m_freewheel.load())+"\",\"freewheel_frames\":\""+std::to_string(m_freewheel_frames.load())+"\",\"freewheel_us\":\""+std::to_string(m_freewheel_us.load())+
+         "\",\"latency_min\":\""+std::to_string(m_latency_min.load())+"\",\"latency_max\":\""+std::to_string(m_latency_max.load())+
+         "\",\"jack_restarts\":\""+std::to_string(m_server->m_supervisor.m_restarts.load())+"\",\"jack_recovery_ms\":\""+std::to_string(m_server->m_supervisor.m_last_recovery_ms.load())+"\","+m_server->m_governor.stats_json()+"}";
+}
+
+/**
+ * Work out how late the outputs play the audio relative to its NDI
+ * timestamp: the measured age when the cycle starts plus the sync group and
+ * user delays. Called from the control thread after the sync groups are
+ * updated; JACK is only asked to recompute when the range moves by more
+ * than a millisecond or the jitter, whichever is larger.
+ */
+void receive_audio::update_latency(void){
+  int64_t delay = m_delay_samples + ((m_sync_group != 0) ? delay_samples(m_sync_delay_us) : 0);
+  int64_t age = m_sync_valid ? delay_samples((int64_t)m_sync_age_us) : 0; //without timestamps only our own delay is known
+  int64_t spread = m_sync_valid ? delay_samples((int64_t)m_sync_jitter_us) : 0;
+  jack_nframes_t latency_min = (jack_nframes_t)std::max((int64_t)0, delay + age - spread);
+  jack_nframes_t latency_max = (jack_nframes_t)std::max((int64_t)0, delay + age + spread);
+  int64_t tolerance = std::max(spread, (int64_t)delay_samples(1000));
+  if((llabs((int64_t)latency_min - m_latency_min.load()) <= tolerance) && (llabs((int64_t)latency_max - m_latency_max.load()) <= tolerance)){
+   return;
+  }
+  m_latency_min = latency_min;
+  m_latency_max = latency_max;
+  m_latency_changed = true;
+}
+
+/**
+ * NDI timestamp of the last period less the JACK time its cycle started, in
+ * microseconds. Adding the JACK to wall clock offset gives the age of the
+ * audio when it is played, which is what sync groups line up.
+ */
+bool receive_audio::timestamp_offset(int64_t *offset_us){
+  *offset_us = m_timestamp_offset_us.load(std::memory_order_relaxed);
+  return *offset_us != INT64_MIN;
+}
+
+/**
+ * Delay the receiver's outputs, e.g. to line it up with local sources.
+ * The delay lines are already allocated, so this is just a parameter.
+ */
+void receive_audio::set_delay(int samples){
+  m_delay_samples = std::min(std::max(samples, 0), delay_samples((int64_t)max_delay_ms * 1000));
+  set_param(param_delay, 0, (float)m_delay_samples);
+}
+
+void receive_audio::set_param(int type, int channel, float value){
+  param_command command = { type, channel, value };
+  trace_scope trace(trace_fine, "queue push");
+  if(!m_commands.push(command)){
+   fprintf(stderr, "parameter queue full - change dropped\n");
+  }
+}
+
+/**
+ * Drain the parameter queue and work out the gain every channel should
+ * reach by the end of this cycle. Runs on the RT thread only.
+ */
+void receive_audio::apply_commands(void){
+  param_command command;
+  bool changed = false;
+  trace_scope trace(trace_fine, "queue pop");
+  while(m_commands.pop(command)){
+   bool valid_channel = (command.channel >= 0) && (command.channel < rt_layout->num_channels);
+   switch(command.type){
+    case param_main_gain: rt_main_gain = command.value; break;
+    case param_gain: rt_gain = command.value; break;
+    case param_mute: rt_mute = (command.value != 0.0f); break;
+    case param_solo_mute: rt_solo_mute = (command.value != 0.0f); break;
+    case param_channel_gain: if(valid_channel){ rt_layout->channel_gain[command.channel] = command.value; } break;
+    case param_channel_mute: if(valid_channel){ rt_layout->channel_mute[command.channel] = (command.value != 0.0f); } break;
+    case param_channel_solo: if(valid_channel){ rt_layout->channel_solo[command.channel] = (command.value != 0.0f); } break;
+    case param_sync_delay: rt_sync_delay = (uint32_t)std::max(0.0f, command.value); break;
+    case param_delay: rt_delay = (uint32_t)std::max(0.0f, command.value); break;
+   }
+   changed = true;
+  }
+  if(changed){
+   update_targets();
+  }
+}
+
+void receive_audio::update_targets(void){
+  receiver_layout &layout = *rt_layout;
+  bool any_solo = false;
+  for (int channel = 0; channel < layout.num_channels; channel++){
+   any_solo = any_solo || layout.channel_solo[channel];
+  }
+  float receiver_gain = (rt_mute || rt_solo_mute) ? 0.0f : rt_main_gain * rt_gain;
+  for (int channel = 0; channel < layout.num_channels; channel++){
+   bool silenced = layout.channel_mute[channel] || (any_solo && !layout.channel_solo[channel]);
+   layout.target_gain[channel] = silenced ? 0.0f : receiver_gain * layout.channel_gain[channel];
+  }
+}
+
+/**
+ * Switch the process callback to a new layout. Outputs both layouts have
+ * keep their parameters and gain, new outputs fade in from silence. Runs
+ * on the RT thread only - the vectors were sized by build_layout().
+ */
+void receive_audio::adopt_layout(receiver_layout *next){
+  int common = std::min(next->num_channels, rt_layout->num_channels);
+  for (int channel = 0; channel < common; channel++){
+   next->channel_gain[channel] = rt_layout->channel_gain[channel];
+   next->channel_mute[channel] = rt_layout->channel_mute[channel];
+   next->channel_solo[channel] = rt_layout->channel_solo[channel];
+   next->current_gain[channel] = rt_layout->current_gain[channel];
+  }
+  m_retired_layout.store(rt_layout, std::memory_order_release);
+  rt_layout = next;
+  update_targets();
+}
+
+int receive_audio::process(jack_nframes_t nframes){
+  receiver_layout *next = m_pending_layout.exchange(NULL, std::memory_order_acquire);
+  if(next){ //the source changed format - swap before anything reads the layout
+   adopt_layout(next);
+  }
+  apply_commands(); //parameter changes take effect at the cycle boundary and ramp over the cycle
+  receiver_layout &layout = *rt_layout;
+  if(nframes > max_period){ //longer than the delay lines allow for - play silence
+   for (int channel = 0; channel < layout.num_channels; channel++){
+    memset(jack_port_get_buffer(layout.ports[channel], nframes), 0, nframes * sizeof(jack_default_audio_sample_t));
+   }
+   return 0;
+  }
+  //Get JACK Audio Buffers
+  bool starved = false;
+  bool freewheel = m_freewheel.load(std::memory_order_relaxed);
+  jack_time_t freewheel_start = freewheel ? jack_get_time() : 0;
+  jack_client_t *client = m_server->m_client;
+  jack_nframes_t cycle = jack_last_frame_time(client);
+  const NDIlib_audio_frame_v3_t &audio_frame = freewheel ? m_silent_frame : *m_shared->capture(cycle, nframes, jack_sample_rate, &starved); //NDI only arrives in real time - nothing is pulled while freewheeling
+  bool timed = (audio_frame.p_data != NULL) && (audio_frame.timestamp != 0) && (audio_frame.timestamp != NDIlib_recv_timestamp_undefined);
+  m_timestamp_offset_us.store(timed ? audio_frame.timestamp / 10 - (int64_t)jack_frames_to_time(client, cycle) : INT64_MIN, std::memory_order_relaxed);
+  if(starved){
+   m_starved++;
+   m_last_starved_us = jack_get_time();
+  }
+  int no_samples = (audio_frame.p_data != NULL) ? audio_frame.no_samples : 0;
+  if(no_samples < (int)nframes){ //short frame - the rest of the JACK buffer is zero filled below
+   if(!freewheel){ //silence is expected while freewheeling, not a dropout
+    m_underruns++;
+    m_last_underrun_us = jack_get_time();
+   }
+  }else if(no_samples > (int)nframes){ //more than the JACK buffer holds - clamp
+   m_overruns++;
+   m_last_overrun_us = jack_get_time();
+   no_samples = nframes;
+  }
+  //printf("Audio data received (%d samples).\n", audio_frame.no_samples);
+  //std::cout << "Number of audio frames (JACK): " << nframes << std::endl;
+  //std::cout << "Audio Frame Data (NDI): " << audio_frame.p_data << std::endl;
+  //std::cout << "Channel Stride in Bytes (NDI): " << audio_frame.channel_stride_in_bytes << std::endl;
+  //std::cout << "Size of Audio Frame (NDI): " << sizeof(audio_frame.p_data) << std::endl;
+  //std::cout << "Number of Audio Channels (NDI): " << sizeof(audio_frame.no_channels) << std::endl;
+  uint32_t delay = std::min(rt_sync_delay + rt_delay, layout.max_delay); //the user delay adds to the sync group alignment
+  uint32_t played = std::min(rt_delay_played, layout.max_delay); //a new layout may allow less
+  uint32_t delay_start = rt_delay_pos & (layout.delay_size - 1);
+  bool render_in_line = (delay > 0) && (delay_start + nframes <= layout.delay_size); //the line is contiguous here - render into it and copy out once
+  for (int channel = 0; channel < layout.num_channels; channel++){ //go through each output
+    out = (jack_default_audio_sample_t*)jack_port_get_buffer(layout.ports[channel], nframes);
+    float *line = &layout.delay_data[channel * layout.delay_size];
+    float *render = render_in_line ? line + delay_start : out;
+    const std::vector<layout_term> &terms = layout.outputs[channel];
+    int written = 0;
+    for (size_t term = 0; term < terms.size(); term++){ //a subset is one term per output, a downmix sums several
+     if(terms[term].source_channel >= audio_frame.no_channels){ //frame still in the old format
+      continue;
+     }
+     p_ch = (jack_default_audio_sample_t*)(uint8_t *)(&audio_frame.p_data[terms[term].source_channel * audio_frame.channel_stride_in_bytes]); //Get channels from NDI audio frame
+     float gain_start = layout.current_gain[channel] * terms[term].coefficient;
+     float gain_end = layout.target_gain[channel] * terms[term].coefficient;
+     if(written++ == 0){
+      gain_ramp(render, p_ch, no_samples, gain_start, gain_end); //copies the adjusted NDI framedata into the JACK buffer
+     }else{
+      mix_ramp(render, p_ch, no_samples, gain_start, gain_end);
+     }
+    }
+    if(written == 0){
+     memset(render, 0, no_samples * sizeof(jack_default_audio_sample_t));
+    }
+    if(no_samples < (int)nframes){ //never leave stale samples in the tail of the buffer
+     memset(render + no_samples, 0, (nframes - no_samples) * sizeof(jack_default_audio_sample_t));
+    }
+    if(!render_in_line){ //keep the line current even without a delay, so adding one never plays old audio
+     delay_write(line, layout.delay_size, delay_start, out, nframes);
+    }
+    if(delay != played){ //jumping to the new read position would click - crossfade from the old one over this cycle
+     float *old_read = m_fade.data();
+     float *new_read = old_read + max_period;
+     delay_read(old_read, line, layout.delay_size, (rt_delay_pos - played) & (layout.delay_size - 1), nframes);
+     delay_read(new_read, line, layout.delay_size, (rt_delay_pos - delay) & (layout.delay_size - 1), nframes);
+     gain_ramp(out, old_read, nframes, 1.0f, 0.0f);
+     mix_ramp(out, new_read, nframes, 0.0f, 1.0f);
+    }else if(delay > 0){
+     delay_read(out, line, layout.delay_size, (rt_delay_pos - delay) & (layout.delay_size - 1), nframes);
+    }
+    layout.current_gain[channel] = layout.target_gain[channel];
+    if(m_mix_feed){
+     m_mix_feed->write(channel, out, nframes);
+    }
+  }
+  rt_delay_pos += nframes;
+  rt_delay_played = delay;
+  if(m_mix_feed){
+   m_mix_feed->commit(nframes);
+  }
+  if(freewheel){ //how much faster than real time the callback can run
+   m_freewheel_frames += nframes;
+   m_freewheel_us += jack_get_time() - freewheel_start;
+  }
+  return 0; //the frame stays with the shared receiver for the other receivers of this cycle      
+}
+
+/**
+ * A sample rate change from the server client. The delay lines depend on
+ * the rate, so the layout thread rebuilds the layout and swaps it in at a
+ * cycle boundary.
+ */
+void receive_audio::sample_rate_changed(jack_nframes_t rate){
+  if(rate != jack_sample_rate){
+   m_pending_sample_rate = rate;
+  }
+}
+
+/**
+ * Publish the receiver's latency as the capture latency of its outputs so
+ * clients downstream can line NDI audio up with their other inputs. There
+ * are no inputs, so there is no playback latency to pass upstream. Runs
+ * from the server client's latency callback.
+ */
+void receive_audio::publish_latency(void){
+  jack_latency_range_t range;
+  range.min = m_latency_min.load();
+  range.max = m_latency_max.load();
+  std::lock_guard<std::mutex> lock(m_ports_lock);
+  for (int channel = 0; channel < m_active_layout->num_channels; channel++){
+   if(m_active_layout->ports[channel]){ //NULL while the server is away
+    jack_port_set_latency_range(m_active_layout->ports[channel], JackCaptureLatency, &range);
+   }
+  }
+}
+
+/**
+ * JACK freewheels for offline bounces, calling process as fast as it can.
+ * NDI audio only arrives in real time, so the receiver renders silence
+ * through its usual path meanwhile and leaves the framesync alone, which
+ * keeps the process callback's throughput measurable.
+ */
+void receive_audio::set_freewheel(bool starting){
+  if(starting){
+   m_freewheel_frames = 0;
+   m_freewheel_us = 0;
+   m_freewheel = true;
+   printf("%s: JACK is freewheeling - outputs are silent\n", m_port_prefix.c_str());
+   return;
+  }
+  if(!m_freewheel.exchange(false)){ //a reconnect also ends freewheeling
+   return;
+  }
+  uint64_t frames = m_freewheel_frames.load();
+  uint64_t process_us = m_freewheel_us.load();
+  double audio_us = frames * 1000000.0 / jack_sample_rate;
+  printf("%s: freewheel ended - %llu frames in %.1fms of process time, %.0fx real time\n", m_port_prefix.c_str(), (unsigned long long)frames, process_us / 1000.0,
+         (process_us > 0) ? audio_us / process_us : 0.0);
+}
+
+//Input ports the server client saw registered - the layout thread applies the rules to them
+void receive_audio::ports_appeared(const std::set<std::string> &ports){
+  std::lock_guard<std::mutex> lock(m_new_ports_lock);
+  m_new_ports.insert(ports.begin(), ports.end());
+}
+
+//Our ports, for the server client to remember their connections
+void receive_audio::collect_ports(std::vector<jack_port_t*> &ports){
+  std::lock_guard<std::mutex> lock(m_ports_lock);
+  ports.insert(ports.end(), m_active_layout->ports.begin(), m_active_layout->ports.end());
+}
+
+/**
+ * Register our ports again on a client reopened after a server restart,
+ * with the same names so the remembered connections find them. Called by
+ * the server client with its client lock held, before it activates.
+ */
+bool receive_audio::register_ports(std::vector<jack_port_t*> &ports){
+  std::lock_guard<std::mutex> lock(m_ports_lock);
+  bool registered = true;
+  for (int channel = 0; channel < m_active_layout->num_channels; channel++){
+   m_active_layout->ports[channel] = jack_port_register (m_server->m_client, port_name(channel).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+   if(m_active_layout->ports[channel] == NULL){
+    fprintf(stderr, "cannot register JACK port %s\n", port_name(channel).c_str());
+    registered = false;
+    continue;
+   }
+   ports.push_back(m_active_layout->ports[channel]);
+  }
+  m_freewheel = false; //a new server starts in real time
+  m_latency_changed = true;
+  return registered;
+}
+
+/**
+ * Build the layout for a source with source_channels channels. Outputs the
+ * active layout already has reuse its ports; extra outputs get new ports,
+ * unless the server is away, when the reconnect registers them. Not RT
+ * safe - called with the server client's lock held.
+ */
+receiver_layout* receive_audio::build_layout(int source_channels){
+  receiver_layout *layout = new receiver_layout;
+  layout->source_channels = source_channels;
+  layout->num_capture_channels = parse_channel_layout(m_layout, source_channels, layout->outputs);
+  layout->num_channels = layout->outputs.size();
+  printf("%d of %d NDI channels used for %d JACK outputs\n", layout->num_capture_channels, source_channels, layout->num_channels);
+  layout->channel_gain.assign(layout->num_channels, 1.0f); //preallocate the per channel state so the RT thread never allocates
+  layout->channel_mute.assign(layout->num_channels, 0);
+  layout->channel_solo.assign(layout->num_channels, 0);
+  layout->current_gain.assign(layout->num_channels, 0.0f);
+  layout->target_gain.assign(layout->num_channels, 0.0f);
+  layout->ports.assign(layout->num_channels, NULL);
+  layout->max_delay = (uint32_t)((max_delay_ms * (int64_t)jack_sample_rate) / 1000);
+  layout->delay_size = 1;
+  while (layout->delay_size < layout->max_delay + max_period){
+   layout->delay_size <<= 1;
+  }
+  layout->delay_data.assign((size_t)layout->delay_size * layout->num_channels, 0.0f); //delay lines are allocated here, never on the RT thread
+
+  /* create output JACK ports */
+  for (int channel = 0; channel < layout->num_channels; channel++){
+   if(m_active_layout && (channel < m_active_layout->num_channels)){
+    layout->ports[channel] = m_active_layout->ports[channel];
+    continue;
+   }
+   if(m_server->is_lost()){ //registered with the others once the server is back
+    continue;
+   }
+   std::string channel_name_string = port_name(channel);
+   //std::cout << "Current Channel Name: " << channel_name_string << std::endl;
+   const char* channel_name_char = channel_name_string.c_str();
+   printf("Creating JACK output port: %s, Channel: %d\n", channel_name_char, channel);
+   layout->ports[channel] = jack_port_register (m_server->m_client, channel_name_char, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+   printf("Output JACK port created for %s\n", channel_name_char);
+   if((layout->ports[channel] == NULL) && !m_server->is_lost()){ //can't create JACK output ports - error
+    fprintf(stderr, "no more JACK ports available\n");
+    exit (1);
+   }
+  }
+  return layout;
+}
+
+/**
+ * Connect outputs from first_channel on by the receiver's connection rules,
+ * or to the physical playback ports in order when it has none and auto
+ * connect is enabled. Only peers in targets are connected when it is not
+ * empty. The matches come from the server's cached graph, and connections
+ * that already exist are skipped, so this is cheap to run again. Called
+ * with the server client's lock held.
+ */
+void receive_audio::auto_connect(receiver_layout *layout, int first_channel, const std::set<std::string> &targets){
+  std::vector<connect_rule> rules;
+  {
+   std::lock_guard<std::mutex> lock(m_rules_lock);
+   rules = m_rules;
+  }
+  if(rules.empty()){
+   if(!auto_connect_jack_ports){
+    return;
+   }
+   connect_rule rule;
+   rule.text = ".*";
+   rule.pattern = std::regex(".*");
+   rule.physical = true;
+   rules.push_back(rule);
+  }
+  if(m_server->is_lost()){ //the reconnect restores the connections
+   return;
+  }
+  for (int channel = first_channel; channel < layout->num_channels; channel++){
+   if(layout->ports[channel] == NULL){
+    return;
+   }
+  }
+  int connected = 0;
+  trace_scope trace(trace_coarse, "jack connect");
+  for (auto &connection : m_server->m_graph.plan(rules, layout->ports.data(), layout->num_channels, first_channel, targets)){
+   int result = jack_connect(m_server->m_client, connection.first.c_str(), connection.second.c_str());
+   if(result && (result != EEXIST)){
+    fprintf(stderr, "cannot connect %s to %s\n", connection.first.c_str(), connection.second.c_str());
+    continue;
+   }
+   connected++;
+  }
+  if(connected > 0){
+   printf("%s: %d connection(s) made by the connection rules\n", m_port_prefix.c_str(), connected);
+  }
+}
+
+/**
+ * Replace the connection rules; the layout thread applies them. Returns
+ * false and keeps the old rules if one does not parse.
+ */
+bool receive_audio::set_connect_rules(const std::string &rules){
+  std::vector<connect_rule> parsed;
+  if(!parse_connect_rules(rules, parsed)){
+   return false;
+  }
+  {
+   std::lock_guard<std::mutex> lock(m_rules_lock);
+   m_rules.swap(parsed);
+  }
+  m_connect_rules = rules;
+  m_rules_changed = true;
+  return true;
+}
+
+/**
+ * Watches the format the process callback sees. A change in source sample
+ * rate is absorbed by the framesync, which always resamples to the JACK
+ * rate; a change in channel count or JACK sample rate rebuilds the layout,
+ * registering or removing only the ports that differ so existing
+ * connections survive. JACK period changes need nothing here - everything
+ * the RT thread touches is sized for max_period. Each pass holds the server
+ * client's lock so a reconnect never swaps the client underneath it.
+ */
+void receive_audio::layout_thread(void){
+  int source_rate = 0;
+  while(!m_exit){
+   std::this_thread::sleep_for(std::chrono::milliseconds(250));
+   std::lock_guard<std::mutex> lock(m_server->m_client_lock);
+   if(m_server->is_lost()){ //the server client is reconnecting
+    continue;
+   }
+   if(m_latency_changed.exchange(false)){ //not allowed from the latency callback itself
+    jack_recompute_total_latencies(m_server->m_client);
+   }
+   std::set<std::string> new_ports;
+   {
+    std::lock_guard<std::mutex> ports_lock(m_new_ports_lock);
+    new_ports.swap(m_new_ports);
+   }
+   if(m_rules_changed.exchange(false)){
+    auto_connect(m_active_layout, 0);
+   }else if(!new_ports.empty()){ //a client started after us - connect it if the rules name it
+    auto_connect(m_active_layout, 0, new_ports);
+   }
+   jack_nframes_t sample_rate = m_pending_sample_rate.exchange(0);
+   if((sample_rate > 0) && (sample_rate != jack_sample_rate)){ //delay lines are sized for the rate - rebuild them
+    printf("%s: JACK sample rate changed from %d to %d Hz\n", m_port_prefix.c_str(), (int)jack_sample_rate, (int)sample_rate);
+    jack_sample_rate = sample_rate;
+    if(!change_layout(m_active_layout->source_channels)){
+     return;
+    }
+   }
+   int rate = m_shared->m_source_rate.load(std::memory_order_relaxed);
+   if((rate > 0) && (rate != source_rate)){
+    if(source_rate > 0){
+     printf("NDI source sample rate changed from %d to %d Hz - resampled to %d Hz\n", source_rate, rate, (int)jack_sample_rate);
+    }
+    source_rate = rate;
+   }
+   int channels = m_shared->m_source_channels.load(std::memory_order_relaxed);
+   if((channels <= 0) || (channels == m_active_layout->source_channels)){ //no audio yet, or unchanged
+    continue;
+   }
+   printf("NDI source channel count changed from %d to %d\n", m_active_layout->source_channels, channels);
+   if(!change_layout(channels)){
+    return;
+   }
+  }
+}
+
+/**
+ * Build a layout for source_channels and swap it in at the next cycle
+ * boundary, then release the ports the new layout no longer uses. Returns
+ * false if we are shutting down before the swap happened.
+ */
+bool receive_audio::change_layout(int source_channels){
+  receiver_layout *next = build_layout(source_channels);
+  int old_channels = m_active_layout->num_channels;
+  m_shared->set_capture_channels(this, std::max(next->num_capture_channels, m_active_layout->num_capture_channels)); //enough for both layouts until the swap
+  m_pending_layout.store(next, std::memory_order_release);
+  receiver_layout *retired = NULL;
+  while (!m_exit && ((retired = m_retired_layout.exchange(NULL, std::memory_order_acquire)) == NULL)){ //wait for a cycle boundary
+   if(m_server->is_lost()){ //no more cycles until JACK is back - swap here, the RT thread is stopped
+    receiver_layout *pending = m_pending_layout.exchange(NULL, std::memory_order_acquire);
+    if(pending){
+     adopt_layout(pending);
+    }
+   }
+   std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if(retired == NULL){ //shutting down - the destructor frees whatever is left
+   return false;
+  }
+  {
+   std::lock_guard<std::mutex> lock(m_ports_lock); //the server client's threads read the ports
+   m_active_layout = next;
+  }
+  for (int channel = next->num_channels; channel < old_channels; channel++){ //the RT thread has stopped using these
+   if(retired->ports[channel] && !m_server->is_lost()){
+    jack_port_unregister(m_server->m_client, retired->ports[channel]);
+   }
+  }
+  delete retired;
+  m_latency_changed = true; //new ports start without a latency
+  m_shared->set_capture_channels(this, next->num_capture_channels);
+  auto_connect(next, old_channels);
+  m_format_changes++;
+  return true;
+}
+
+//Constructor
+receive_audio::receive_audio(const char* source, const char *client_name, int channel_count, const char *layout, const char *rules, const char *server_name): m_layout(layout), m_server_name(server_name), m_timestamp_offset_us(INT64_MIN), m_pending_sample_rate(0), m_latency_min(0), m_latency_max(0), m_latency_changed(false), m_rules_changed(false), m_freewheel(false), m_freewheel_frames(0), m_freewheel_us(0), m_pending_layout(NULL), m_retired_layout(NULL), m_format_changes(0), m_underruns(0), m_overruns(0), m_starved(0), m_last_underrun_us(0), m_last_overrun_us(0), m_last_starved_us(0), m_shared(NULL), m_server(NULL), m_exit(false){
+  printf("Starting Receiver for %s\n", source);
+  rt_main_gain = main_volume;
+  m_silent_frame.no_channels = 0; //no channels, so rendering never reads p_data
+  m_fade.assign(2 * max_period, 0.0f); //written now, so the RT thread never faults on it
+  m_silent_frame.no_samples = 0;
+  m_silent_frame.p_data = NULL;
+
+  m_server = jack_server_client::acquire(m_server_name, client_name); //opens the client for the first receiver on the server
+  jack_nframes_t server_rate = m_server->m_sample_rate.load();
+  jack_sample_rate = (server_rate > 0) ? server_rate : 48000; //corrected by the sample rate callback once the server is reached
+  m_port_prefix = m_server->unique_prefix(source);
+  if(!parse_connect_rules(rules, m_rules)){
+   fprintf(stderr, "%s: connection rules ignored\n", m_port_prefix.c_str());
+  }else{
+   m_connect_rules = rules;
+  }
+
+  std::lock_guard<std::mutex> lock(m_server->m_client_lock);
+  //initialize data structures for variable channels
+  m_active_layout = build_layout(channel_count);
+  m_active_layout->current_gain.assign(m_active_layout->num_channels, main_volume); //start at the main volume rather than fading in
+  m_active_layout->target_gain.assign(m_active_layout->num_channels, main_volume);
+  rt_layout = m_active_layout;
+  m_shared = shared_receiver::acquire(source, m_server_name); //connects to the source, or joins the receivers already on it
+  m_shared->set_capture_channels(this, m_active_layout->num_capture_channels);
+  if((mix_buses > 0) && m_server_name.empty()){ //the mixer runs on the default server - other servers have their own clocks
+   m_mix_feed = new mix_feed(m_active_layout->num_channels);
+  }
+
+  /* The server client's process callback runs us from the next cycle on */
+  m_server->add(this);
+
+  /* Connect the ports.  You can't do this before the client is
+   * activated, because we can't make connections to clients
+   * that aren't running.  Note the confusing (but necessary)
+   * orientation of the driver backend ports: playback ports are
+   * "input" to the backend, and capture ports are "output" from
+   * it.
+   */
+  auto_connect(m_active_layout, 0);
+  m_layout_thread = std::thread(&receive_audio::layout_thread, this);
+}
+
+// Destructor
+receive_audio::~receive_audio(void){	// Wait for the thread to exit
+	m_exit = true;
+  m_layout_thread.join();
+  {
+   std::lock_guard<std::mutex> lock(m_server->m_client_lock); //no reconnect starts the RT thread while we leave
+   m_server->remove(this); //the process callback has stopped running us
+   for (int channel = 0; !m_server->is_lost() && (channel < rt_layout->num_channels); channel++){ //a lost server took the ports with it
+    if(rt_layout->ports[channel]){
+     jack_port_unregister(m_server->m_client, rt_layout->ports[channel]);
+    }
+   }
+  }
+  m_server->release(); //the JACK client is closed with its last receiver
+	// Leave the receiver - the NDI connection is closed with its last user
+  m_shared->set_capture_channels(this, 0);
+  m_shared->release();
+  delete m_pending_layout.exchange(NULL); //a layout change the RT thread never took
+  delete m_retired_layout.exchange(NULL);
+  delete rt_layout;
+  delete m_mix_feed; //the mixer has already stopped reading it
+}
+
+/**
+ * The process callback for this JACK application is called in a
+ * special realtime thread once for each audio cycle.
+ */
+int process_callback(jack_nframes_t x, void *p){
+ rt_check_scope scope; //with -DRT_CHECK, records anything in the cycle that allocates or blocks
+ trace_scope trace(trace_coarse, "jack process");
+ return static_cast<jack_server_client*>(p)->process(x); 
+}
+
+jack_server_client::jack_server_client(const std::string &server_name, const char *client_name): m_server_name(server_name), m_client_name(client_name), m_client(NULL), m_sample_rate(0), rt_receivers(new std::vector<receive_audio*>), m_pending(NULL), m_retired(NULL), m_exit(false), m_freewheel(false){
+  if(!open()){ //wait for the server rather than exit - it may be started after us
+   fprintf(stderr, "JACK server %s is not running - waiting for it\n", m_server_name.empty() ? "default" : m_server_name.c_str());
+   m_supervisor.lost();
+  }
+  m_supervisor_thread = std::thread(&jack_server_client::supervise, this);
+}
+
+jack_server_client::~jack_server_client(void){
+  m_exit = true;
+  m_supervisor_thread.join();
+  if(m_client){ //NULL if we were still waiting for JACK to come back
+   jack_client_close(m_client);
+  }
+  delete m_pending.exchange(NULL);
+  delete m_retired.exchange(NULL);
+  delete rt_receivers;
+}
+
+/**
+ * The client for server_name, opened for its first receiver. Receivers
+ * share it, so the server sees one ndi2jack client however many sources
+ * play to it.
+ */
+jack_server_client* jack_server_client::acquire(const std::string &server_name, const char *client_name){
+  for (jack_server_client *server : s_servers){
+   if(server->m_server_name == server_name){
+    server->m_references++;
+    return server;
+   }
+  }
+  jack_server_client *server = new jack_server_client(server_name, client_name);
+  server->m_references = 1;
+  s_servers.push_back(server);
+  return server;
+}
+
+void jack_server_client::release(void){
+  if(--m_references > 0){
+   return;
+  }
+  s_servers.erase(std::find(s_servers.begin(), s_servers.end(), this));
+  delete this;
+}
+
+/**
+ * Port name prefix for a receiver of source. JACK uses ':' between client
+ * and port, so it is replaced, and a number is added when the source is
+ * already playing on this server.
+ */
+std::string jack_server_client::unique_prefix(const std::string &source){
+  std::string prefix = source.substr(0, 64);
+  std::replace(prefix.begin(), prefix.end(), ':', '_');
+  std::lock_guard<std::mutex> lock(m_receivers_lock);
+  std::string candidate = prefix;
+  for (int copy = 2; ; copy++){
+   bool taken = false;
+   for (receive_audio *receiver : m_receivers){
+    taken = taken || (receiver->m_port_prefix == candidate);
+   }
+   if(!taken){
+    return candidate;
+   }
+   candidate = prefix + " #" + std::to_string(copy);
+  }
+}
+
+/**
+ * Open and activate the client with no ports; receivers register theirs as
+ * they are added. Returns false if the server cannot be reached.
+ */
+bool jack_server_client::open(void){
+  jack_status_t status;
+  /* open a client connection to the JACK server */
+  fprintf (stderr, "Opening connection to JACK server %s...\n", m_server_name.empty() ? "default" : m_server_name.c_str());
+  if(m_server_name.empty()){
+   m_client = jack_client_open (m_client_name.c_str(), JackNullOption, &status, NULL);
+  }else{
+   m_client = jack_client_open (m_client_name.c_str(), JackServerName, &status, m_server_name.c_str());
+  }
+  if(m_client == NULL){
+   fprintf (stderr, "jack_client_open() failed, ""status = 0x%2.0x\n", status);
+   if(status & JackServerFailed){
+	  fprintf (stderr, "Unable to connect to JACK server\n");
+   }
+   return false;
+  }
+  fprintf (stderr, "JACK server connection opened\n");
+  if(status & JackServerStarted){
+   fprintf (stderr, "JACK server started\n");
+  }
+  if(status & JackNameNotUnique){
+   fprintf (stderr, "unique name `%s' assigned\n", jack_get_client_name(m_client));
+  }
+  m_client_name = jack_get_client_name(m_client);
+  m_sample_rate = jack_get_sample_rate(m_client);
+
+  jack_set_process_callback (m_client, ::process_callback, this); //This callback is called on every every time JACK does work - every audio sample
+  jack_set_sample_rate_callback (m_client, jack_server_client::sample_rate_callback, this);
+  jack_set_buffer_size_callback (m_client, jack_server_client::buffer_size_callback, this);
+  jack_set_latency_callback (m_client, jack_server_client::latency_callback, this); //lets clients downstream compensate for the NDI buffering
+  jack_set_freewheel_callback (m_client, jack_server_client::freewheel_callback, this);
+  jack_on_shutdown (m_client, jack_server_client::jack_shutdown, this); //JACK shutdown callback - gets called on JACK shutdown
+  jack_set_thread_init_callback (m_client, rt_thread_init, NULL); //flush denormals and prefault the stack in the RT thread
+  m_graph.attach(m_client);
+
+  /* Tell the JACK server that we are ready to roll.  Our
+   * process() callback will start running now. */
+  if(jack_activate (m_client)){
+   fprintf (stderr, "cannot activate client\n");
+   jack_client_close(m_client); //the supervisor opens a new one
+   m_client = NULL;
+   return false;
+  }
+  m_graph.load(); //one read of the graph - the callbacks keep it current from here on
+  return true;
+}
+
+//Runs every receiver of the server, one after another, on the RT thread
+int jack_server_client::process(jack_nframes_t nframes){
+  jack_time_t process_start = jack_get_time();
+  std::vector<receive_audio*> *next = m_pending.exchange(NULL, std::memory_order_acquire);
+  if(next){ //a receiver joined or left - swap at the cycle boundary
+   m_retired.store(rt_receivers, std::memory_order_release);
+   rt_receivers = next;
+  }
+  for (receive_audio *receiver : *rt_receivers){
+   receiver->process(nframes);
+  }
+  if(!m_freewheel.load(std::memory_order_relaxed)){
+   m_governor.record_cycle(jack_get_time() - process_start);
+  }
+  return 0;
+}
+
+int jack_server_client::load_level(void){
+  int level = load_level_full;
+  for (jack_server_client *server : s_servers){
+   level = std::max(level, server->m_governor.level());
+  }
+  return level;
+}
+
+/**
+ * Hand the RT thread a copy of the receiver list and wait for it to let go
+ * of the old one, so a receiver that was removed is no longer running.
+ */
+void jack_server_client::publish(void){
+  m_pending.store(new std::vector<receive_audio*>(m_receivers), std::memory_order_release);
+  std::vector<receive_audio*> *retired = NULL;
+  while ((retired = m_retired.exchange(NULL, std::memory_order_acquire)) == NULL){ //wait for a cycle boundary
+   if(is_lost()){ //no cycles while the server is away - swap here, the RT thread is stopped
+    std::vector<receive_audio*> *pending = m_pending.exchange(NULL, std::memory_order_acquire);
+    if(pending){
+     retired = rt_receivers;
+     rt_receivers = pending;
+     break;
+    }
+   }
+   std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  delete retired;
+}
+
+void jack_server_client::add(receive_audio *receiver){
+  {
+   std::lock_guard<std::mutex> lock(m_receivers_lock);
+   m_receivers.push_back(receiver);
+  }
+  publish();
+}
+
+void jack_server_client::remove(receive_audio *receiver){
+  {
+   std::lock_guard<std::mutex> lock(m_receivers_lock);
+   m_receivers.erase(std::find(m_receivers.begin(), m_receivers.end(), receiver));
+  }
+  publish();
+}
+
+/**
+ * JACK calls this shutdown_callback if the server ever shuts down or
+ * decides to disconnect the client. The NDI side keeps running and the
+ * supervising thread reconnects once the server is back.
+ */
+void jack_server_client::jack_shutdown(void *arg){
+  static_cast<jack_server_client*>(arg)->m_supervisor.lost();
+}
+
+/**
+ * JACK calls this when the server sample rate changes, and once when the
+ * callback is set. Each receiver rebuilds its delay lines for the new rate.
+ */
+int jack_server_client::sample_rate_callback(jack_nframes_t nframes, void *arg){
+  static_cast<jack_server_client*>(arg)->sample_rate_changed(nframes);
+  return 0;
+}
+
+void jack_server_client::sample_rate_changed(jack_nframes_t rate){
+  m_sample_rate = rate;
+  std::lock_guard<std::mutex> lock(m_receivers_lock);
+  for (receive_audio *receiver : m_receivers){
+   receiver->sample_rate_changed(rate);
+  }
+}
+
+//The period can change while running; the RT buffers are sized for max_period so there is nothing to reallocate
+int jack_server_client::buffer_size_callback(jack_nframes_t nframes, void *arg){
+  jack_server_client *server = static_cast<jack_server_client*>(arg);
+  printf("%s: JACK period is %d samples\n", server->m_client_name.c_str(), (int)nframes);
+  if(nframes > max_period){
+   fprintf(stderr, "%s: JACK period is longer than %d samples - outputs are silent\n", server->m_client_name.c_str(), (int)max_period);
+  }
+  return 0;
+}
+
+//Each receiver publishes its own latency on its outputs
+void jack_server_client::latency_callback(jack_latency_callback_mode_t mode, void *arg){
+  jack_server_client *server = static_cast<jack_server_client*>(arg);
+  if(mode != JackCaptureLatency){
+   return;
+  }
+  std::lock_guard<std::mutex> lock(server->m_receivers_lock);
+  for (receive_audio *receiver : server->m_receivers){
+   receiver->publish_latency();
+  }
+}
+
+void jack_server_client::freewheel_callback(int starting, void *arg){
+  jack_server_client *server = static_cast<jack_server_client*>(arg);
+  server->m_freewheel = (starting != 0);
+  std::lock_guard<std::mutex> lock(server->m_receivers_lock);
+  for (receive_audio *receiver : server->m_receivers){
+   receiver->set_freewheel(starting != 0);
+  }
+}
+
+/**
+ * Open the client again after a server restart with the same name, have
+ * every receiver register its ports again and put back the connections the
+ * ports had. The process callback is not running while the server is gone.
+ */
+void jack_server_client::reconnect(void){
+  fprintf(stderr, "%s: JACK server went away - reconnecting\n", m_client_name.c_str());
+  {
+   std::lock_guard<std::mutex> lock(m_client_lock);
+   if(m_client){
+    jack_client_close(m_client);
+    m_client = NULL;
+   }
+  }
+  jack_client_t *client = m_supervisor.reopen(m_client_name.c_str(), m_exit, m_server_name.c_str()); //the receivers carry on without the lock meanwhile
+  if(client == NULL){ //shutting down
+   return;
+  }
+  std::lock_guard<std::mutex> lock(m_client_lock);
+  m_client = client;
+  jack_set_process_callback (m_client, ::process_callback, this);
+  jack_set_sample_rate_callback (m_client, jack_server_client::sample_rate_callback, this); //picks up a server restarted at another rate
+  jack_set_buffer_size_callback (m_client, jack_server_client::buffer_size_callback, this);
+  jack_set_latency_callback (m_client, jack_server_client::latency_callback, this);
+  jack_set_freewheel_callback (m_client, jack_server_client::freewheel_callback, this);
+  jack_on_shutdown (m_client, jack_server_client::jack_shutdown, this);
+  jack_set_thread_init_callback (m_client, rt_thread_init, NULL);
+  m_graph.attach(m_client);
+  std::vector<jack_port_t*> ports;
+  bool registered = true;
+  {
+   std::lock_guard<std::mutex> receivers_lock(m_receivers_lock);
+   for (receive_audio *receiver : m_receivers){
+    registered = receiver->register_ports(ports) && registered;
+   }
+  }
+  if(!registered){ //the client is closed and opened again on the next pass
+   m_supervisor.lost();
+   return;
+  }
+  if(jack_activate (m_client)){
+   fprintf (stderr, "cannot activate client");
+   m_supervisor.lost(); //try again on the next pass
+   return;
+  }
+  m_graph.load();
+  m_freewheel = false;
+  m_supervisor.restore(m_client, ports.data(), ports.size());
+  m_supervisor.recovered();
+}
+
+/**
+ * Reconnects while the server is away, passes new input ports on to the
+ * receivers' connection rules, takes a load reading and remembers our
+ * connections in case the server goes away.
+ */
+void jack_server_client::supervise(void){
+  int ticks = 0;
+  while(!m_exit){
+   std::this_thread::sleep_for(std::chrono::milliseconds(250));
+   if(m_supervisor.is_lost()){
+    reconnect();
+    continue;
+   }
+   if(!m_freewheel){ //the control thread reads the level and sheds its own work
+    m_governor.sample(m_client, 250, m_client_name.c_str());
+   }
+   std::set<std::string> new_ports = m_graph.take_new_ports();
+   if(!new_ports.empty()){
+    std::lock_guard<std::mutex> lock(m_receivers_lock);
+    for (receive_audio *receiver : m_receivers){
+     receiver->ports_appeared(new_ports);
+    }
+   }
+   if(++ticks % 4 == 0){ //once a second - the server is gone by the time we hear it has stopped
+    std::lock_guard<std::mutex> lock(m_client_lock);
+    std::vector<jack_port_t*> ports;
+    {
+     std::lock_guard<std::mutex> receivers_lock(m_receivers_lock);
+     for (receive_audio *receiver : m_receivers){
+      receiver->collect_ports(ports);
+     }
+    }
+    if(!m_supervisor.is_lost()){
+     m_supervisor.remember(m_client, ports.data(), ports.size());
+    }
+   }
+  }
+}
+
+struct mix_entry {
+  mix_feed *feed;
+  int receiver; //receiver slot, for reporting
+  int channel; //receiver channel
+  int bus;
+  float gain; //target gain
+  float current; //gain the RT thread reached - carried over when the matrix is replaced
+};
+
+struct mix_matrix {
+  std::vector<mix_entry> entries; //sorted by bus, then feed and channel
+  std::vector<mix_feed*> feeds; //every feed read by the entries
+  uint64_t generation;
+};
+
+/**
+ * Optional internal mixer: a sparse gain matrix from every receiver channel
+ * to a set of bus output ports, summed in one process callback. The matrix
+ * is edited on the control thread and swapped in at a cycle boundary; gains
+ * ramp from their old value so edits never click.
+ */
+struct mix_bus {
+ mix_bus(int bus_count, const char *client_name = "NDI_mix"); //constructor
+ ~mix_bus(void); //destructor
+ public:
+  int process(jack_nframes_t nframes);
+  void set_gain(mix_feed *feed, int receiver, int channel, int bus, float gain); //control thread
+  void remove_feed(mix_feed *feed);
+  std::string matrix_json(void);
+  static int process_callback(jack_nframes_t x, void *p);
+ private:
   jack_client_t *jack_client;
-  jack_nframes_t jack_sample_rate;
-  float channel_volume = 1.0f; //set channel volume to full
-  int num_channels = 2; //default number of channels
-	std::atomic<bool> m_exit;	// Are we ready to exit	
-  static void jack_shutdown(void *arg); //This is called when JACK is shutdown
+  jack_port_t **out_ports;
+  jack_default_audio_sample_t **m_out; //bus buffers for the current cycle
+  int num_buses;
+  float *m_scratch; //holds a period that wraps around a feed ring
+  std::vector<mix_entry> m_master; //control thread copy of the matrix
+  uint64_t m_generation = 0;
+  std::atomic<mix_matrix*> m_pending; //published by the control thread, taken by the RT thread
+  std::atomic<uint64_t> m_active_generation; //generation the RT thread is mixing
+  spsc_queue<mix_matrix*, 64> m_retired; //replaced matrices for the control thread to free
+  mix_matrix *rt_active = NULL;
+  std::atomic<uint64_t> m_cycles; //process callback timing
+  std::atomic<uint64_t> m_process_us;
+  std::atomic<uint64_t> m_process_max_us;
+  void publish(void);
+  std::string m_client_name;
+  jack_supervisor m_supervisor;
+  std::atomic<bool> m_exit;
+  std::thread m_supervisor_thread; //reconnects after a JACK restart
+  void supervise(void);
+  static void jack_shutdown(void *arg);
 };
 
-int receive_audio::process(jack_nframes_t nframes){
-  //Get JACK Audio Buffers
-  NDIlib_framesync_capture_audio_v2(m_pNDI_framesync, &audio_frame, jack_sample_rate, num_channels, nframes);
-  //printf("Audio data received (%d samples).\n", audio_frame.no_samples);
-  //std::cout << "Number of audio frames (JACK): " << nframes << std::endl;
-  //std::cout << "Audio Frame Data (NDI): " << audio_frame.p_data << std::endl;
-  //std::cout << "Channel Stride in Bytes (NDI): " << audio_frame.channel_stride_in_bytes << std::endl;
-  //std::cout << "Size of Audio Frame (NDI): " << sizeof(audio_frame.p_data) << std::endl;
-  //std::cout << "Number of Audio Channels (NDI): " << sizeof(audio_frame.no_channels) << std::endl;
-  for (int channel = 0; channel < num_channels; channel++){ //go through each channel
-    out = (jack_default_audio_sample_t*)jack_port_get_buffer(out_ports[channel], nframes);
-    p_ch = (jack_default_audio_sample_t*)(uint8_t *)(&audio_frame.p_data[channel * audio_frame.channel_stride_in_bytes]); //Get channels from NDI audio frame
-    for (int sample_no = 0; sample_no < audio_frame.no_samples; sample_no++){ //apply the volume to each sample
-      out[sample_no] = p_ch[sample_no] * main_volume * channel_volume; //copies the adjusted NDI framedata into the JACK buffer
+static bool mix_entry_less(const mix_entry &a, const mix_entry &b){
+  if(a.bus != b.bus){
+   return a.bus < b.bus;
+  }
+  if(a.feed != b.feed){
+   return (uintptr_t)a.feed < (uintptr_t)b.feed;
+  }
+  return a.channel < b.channel;
+}
+
+int mix_bus::process(jack_nframes_t nframes){
+  jack_time_t start = jack_get_time();
+  mix_matrix *next = (rt_active && m_retired.full()) ? NULL : m_pending.exchange(NULL); //no room to retire the old matrix - keep it until the control thread catches up
+  if(next){ //new matrix - carry the current gains over so the change ramps from where we are
+   if(rt_active){
+    size_t old_index = 0;
+    for (mix_entry &entry : next->entries){
+     while ((old_index < rt_active->entries.size()) && mix_entry_less(rt_active->entries[old_index], entry)){
+      old_index++;
+     }
+     if((old_index < rt_active->entries.size()) && !mix_entry_less(entry, rt_active->entries[old_index])){
+      entry.current = rt_active->entries[old_index].current;
+     }
     }
+    m_retired.push(rt_active);
+   }
+   rt_active = next;
+   m_active_generation = next->generation;
+  }
+
+  jack_default_audio_sample_t **out = m_out;
+  for (int bus = 0; bus < num_buses; bus++){
+   out[bus] = (jack_default_audio_sample_t*)jack_port_get_buffer(out_ports[bus], nframes);
+   memset(out[bus], 0, nframes * sizeof(jack_default_audio_sample_t));
+  }
+  if(rt_active){
+   for (mix_feed *feed : rt_active->feeds){
+    feed->begin_read(nframes);
+   }
+   for (mix_entry &entry : rt_active->entries){ //entries are grouped by bus so each output stays in cache
+    if(!entry.feed->rt_ready || ((entry.current == 0.0f) && (entry.gain == 0.0f))){
+     continue;
+    }
+    const float *src = entry.feed->read_block(entry.channel, nframes, m_scratch);
+    if(src){
+     mix_ramp(out[entry.bus], src, nframes, entry.current, entry.gain);
+    }
+    entry.current = entry.gain;
+   }
+   for (mix_feed *feed : rt_active->feeds){
+    feed->consume(nframes);
+   }
+  }
+  uint64_t elapsed = jack_get_time() - start;
+  m_cycles++;
+  m_process_us += elapsed;
+  if(elapsed > m_process_max_us){
+   m_process_max_us = elapsed;
   }
-  // Release the NDI audio frame. You could keep the frame if you want and release it later.
-  NDIlib_framesync_free_audio_v2(m_pNDI_framesync, &audio_frame);
-  return 0;      
+  return 0;
 }
 
-/**
- * JACK calls this shutdown_callback if the server ever shuts down or
- * decides to disconnect the client.
- */
-void receive_audio::jack_shutdown(void *arg){
-  exit(1);
+//Build a new matrix from the control thread copy and hand it to the RT thread
+void mix_bus::publish(void){
+  mix_matrix *retired;
+  while(m_retired.pop(retired)){
+   delete retired;
+  }
+  mix_matrix *matrix = new mix_matrix();
+  matrix->entries = m_master;
+  std::sort(matrix->entries.begin(), matrix->entries.end(), mix_entry_less);
+  for (const mix_entry &entry : matrix->entries){
+   if(std::find(matrix->feeds.begin(), matrix->feeds.end(), entry.feed) == matrix->feeds.end()){
+    matrix->feeds.push_back(entry.feed);
+   }
+  }
+  matrix->generation = ++m_generation;
+  mix_matrix *unused = m_pending.exchange(matrix);
+  delete unused; //the RT thread never saw it
 }
 
-//Constructor
-receive_audio::receive_audio(const char* source, const char *client_name, int channel_count): m_pNDI_recv(NULL), m_pNDI_framesync(NULL), m_exit(false), jack_client(NULL){
-  printf("Starting Receiver for %s\n", source);
-  const char **found_ports;
-  const char *server_name = NULL;
-  jack_options_t options = JackNullOption;
-  jack_status_t status;
+void mix_bus::set_gain(mix_feed *feed, int receiver, int channel, int bus, float gain){
+  if((feed == NULL) || (bus < 0) || (bus >= num_buses) || (channel < 0)){
+   return;
+  }
+  for (mix_entry &entry : m_master){
+   if((entry.feed == feed) && (entry.channel == channel) && (entry.bus == bus)){
+    entry.gain = gain; //a gain of 0 keeps the entry so it can ramp out
+    publish();
+    return;
+   }
+  }
+  mix_entry entry = { feed, receiver, channel, bus, gain, 0.0f };
+  m_master.push_back(entry);
+  publish();
+}
 
-  NDIlib_recv_create_v3_t recv_create_desc;
-  recv_create_desc.source_to_connect_to = source;
-  recv_create_desc.bandwidth = NDIlib_recv_bandwidth_audio_only; //specify receiving audio frames only
-  recv_create_desc.p_ndi_recv_name = "NDI Receiver";
-  num_channels = channel_count;
+//Drop a receiver from the matrix and wait until the RT thread no longer reads its feed
+void mix_bus::remove_feed(mix_feed *feed){
+  size_t entry_count = m_master.size();
+  m_master.erase(std::remove_if(m_master.begin(), m_master.end(), [feed](const mix_entry &entry){ return entry.feed == feed; }), m_master.end());
+  if(m_master.size() == entry_count){
+   return;
+  }
+  publish();
+  uint64_t generation = m_generation;
+  for (int i = 0; (i < 500) && (m_active_generation.load() < generation); i++){
+   std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
 
-  /* open a client connection to the JACK server */
-  fprintf (stderr, "Opening connection to JACK server...\n");
-  jack_client = jack_client_open (client_name, options, &status, server_name);
-  fprintf (stderr, "JACK server connection opened\n");
-  if(jack_client == NULL){
-   fprintf (stderr, "jack_client_open() failed, ""status = 0x%2.0x\n", status);
-   if(status & JackServerFailed){
-	  fprintf (stderr, "Unable to connect to JACK server\n");
+std::string mix_bus::matrix_json(void){
+  std::string entries_json = "";
+  for (const mix_entry &entry : m_master){
+   if(entries_json != ""){
+    entries_json += ",";
    }
-   exit (1);
-  }
-  if(status & JackServerStarted){
-   fprintf (stderr, "JACK server started\n");
+   entries_json += "{\"receiver\":\""+std::to_string(entry.receiver)+"\",\"channel\":\""+std::to_string(entry.channel)+"\",\"bus\":\""+std::to_string(entry.bus)+"\",\"gain\":\""+std::to_string(entry.gain)+"\"}";
   }
-  if(status & JackNameNotUnique){
-   client_name = jack_get_client_name(jack_client);
-   fprintf (stderr, "unique name `%s' assigned\n", client_name);
+  uint64_t cycles = m_cycles.load();
+  std::string stats_json = "\"buses\":\""+std::to_string(num_buses)+"\",\"avg_us\":\""+std::to_string(cycles ? m_process_us.load() / cycles : 0)+"\",\"max_us\":\""+std::to_string(m_process_max_us.load())+
+                           "\",\"jack_restarts\":\""+std::to_string(m_supervisor.m_restarts.load())+"\",\"jack_recovery_ms\":\""+std::to_string(m_supervisor.m_last_recovery_ms.load())+"\"";
+  return "{\"prefix\":\"mix_matrix\",\"action\":\"display\","+stats_json+",\"entries\":["+entries_json+"]}";
+}
+
+void mix_bus::jack_shutdown(void *arg){
+  static_cast<mix_bus*>(arg)->m_supervisor.lost();
+}
+
+//Remember the bus connections and bring the client back after a JACK restart
+void mix_bus::supervise(void){
+  int ticks = 0;
+  while (!m_exit){
+   std::this_thread::sleep_for(std::chrono::milliseconds(250));
+   if(!m_supervisor.is_lost()){
+    if(++ticks % 4 == 0){
+     m_supervisor.remember(jack_client, out_ports, num_buses);
+    }
+    continue;
+   }
+   fprintf(stderr, "%s: JACK server went away - reconnecting\n", m_client_name.c_str());
+   jack_client_close(jack_client);
+   jack_client = m_supervisor.reopen(m_client_name.c_str(), m_exit);
+   if(jack_client == NULL){
+    return;
+   }
+   jack_set_process_callback (jack_client, mix_bus::process_callback, this);
+   jack_on_shutdown (jack_client, mix_bus::jack_shutdown, this);
+   jack_set_thread_init_callback (jack_client, rt_thread_init, NULL);
+   bool registered = true;
+   for (int bus = 0; bus < num_buses; bus++){
+    std::string bus_name_string = "bus_" + std::to_string(bus);
+    out_ports[bus] = jack_port_register (jack_client, bus_name_string.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+    registered = registered && (out_ports[bus] != NULL);
+   }
+   if(!registered){
+    fprintf (stderr, "%s: cannot register JACK ports\n", m_client_name.c_str());
+    continue; //still marked lost - try again, before process() can see a NULL port
+   }
+   if(jack_activate (jack_client)){
+    fprintf (stderr, "cannot activate client");
+    continue; //still marked lost - try again
+   }
+   m_supervisor.restore(jack_client, out_ports, num_buses);
+   m_supervisor.recovered();
   }
+}
 
-  jack_sample_rate = jack_get_sample_rate(jack_client);
-  
-  jack_set_process_callback (jack_client, ::process_callback, this); //This callback is called on every every time JACK does work - every audio sample
-  jack_on_shutdown (jack_client, receive_audio::jack_shutdown, 0); //JACK shutdown callback - gets called on JACK shutdown
-  
-  //initialize data structures for variable channels
-  out_ports = (jack_port_t**)malloc(sizeof (jack_port_t*) * num_channels);
+int mix_bus::process_callback(jack_nframes_t x, void *p){
+ rt_check_scope scope;
+ trace_scope trace(trace_coarse, "mix process");
+ return static_cast<mix_bus*>(p)->process(x);
+}
 
-  /* create output JACK ports */
-  for (int channel = 0; channel < num_channels; channel++){
-   std::string channel_name_string = "output_" + std::to_string(channel);
-   //std::cout << "Current Channel Name: " << channel_name_string << std::endl;
-   const char* channel_name_char = channel_name_string.c_str();
-   printf("Creating JACK output port: %s, Channel: %d\n", channel_name_char, channel);
-   out_ports[channel] = jack_port_register (jack_client, channel_name_char, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-   printf("Output JACK port created for %s\n", channel_name_char);
-   if(out_ports[channel] == NULL){ //can't create JACK output ports - error
+//Constructor
+mix_bus::mix_bus(int bus_count, const char *client_name): jack_client(NULL), num_buses(bus_count), m_pending(NULL), m_active_generation(0), m_cycles(0), m_process_us(0), m_process_max_us(0), m_exit(false){
+  printf("Starting mixer with %d buses\n", num_buses);
+  jack_status_t status;
+  jack_client = jack_client_open (client_name, JackNullOption, &status, NULL);
+  if(jack_client == NULL){
+   fprintf (stderr, "jack_client_open() failed, ""status = 0x%2.0x\n", status);
+   exit (1);
+  }
+  m_scratch = (float*)malloc(max_period * sizeof(float)); //any period JACK switches to fits without reallocating
+  rt_prefault(m_scratch, max_period * sizeof(float));
+  jack_set_process_callback (jack_client, mix_bus::process_callback, this);
+  jack_on_shutdown (jack_client, mix_bus::jack_shutdown, this);
+  jack_set_thread_init_callback (jack_client, rt_thread_init, NULL); //flush denormals and prefault the stack in the RT thread
+  m_client_name = jack_get_client_name(jack_client);
+  out_ports = (jack_port_t**)malloc(sizeof (jack_port_t*) * num_buses);
+  m_out = (jack_default_audio_sample_t**)malloc(sizeof (jack_default_audio_sample_t*) * num_buses);
+  for (int bus = 0; bus < num_buses; bus++){
+   std::string bus_name_string = "bus_" + std::to_string(bus);
+   out_ports[bus] = jack_port_register (jack_client, bus_name_string.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+   if(out_ports[bus] == NULL){
     fprintf(stderr, "no more JACK ports available\n");
     exit (1);
    }
   }
-
-  /* Tell the JACK server that we are ready to roll.  Our
-   * process() callback will start running now. */
   if(jack_activate (jack_client)){
    fprintf (stderr, "cannot activate client");
    exit (1);
   }
+  m_supervisor_thread = std::thread(&mix_bus::supervise, this);
+}
 
-  /* Connect the ports.  You can't do this before the client is
-   * activated, because we can't make connections to clients
-   * that aren't running.  Note the confusing (but necessary)
-   * orientation of the driver backend ports: playback ports are
-   * "input" to the backend, and capture ports are "output" from
-   * it.
-   */
-  if(auto_connect_jack_ports == true){ //make sure auto connect is enabled
-   found_ports = jack_get_ports (jack_client, NULL, NULL, JackPortIsInput);
-   if (found_ports) {
-    int i;
-		for (i = 0; found_ports[i]; ++i) {
-			printf("name: %s\n", found_ports[i]);
-		}
-   }
+// Destructor
+mix_bus::~mix_bus(void){
+  m_exit = true;
+  m_supervisor_thread.join();
+  if(jack_client){
+   jack_client_close(jack_client);
+  }
+  delete rt_active;
+  delete m_pending.exchange(NULL);
+  mix_matrix *retired;
+  while(m_retired.pop(retired)){
+   delete retired;
+  }
+  free(m_scratch);
+  free(m_out);
+  free(out_ports);
+}
+
+/**
+ * Sources seen by the NDI finder. Each source is keyed by a hash of its name
+ * and URL, so its id stays the same however the finder reorders its list,
+ * and the generation counts changes to the set of sources. The web page
+ * connects by id and generation rather than by position in the finder list.
+ */
+struct catalog_source {
+  uint64_t id;
+  std::string name;
+  std::string url;
+  std::string match_key; //lower case name and URL for searching
+  uint64_t added_generation; //generation the source (re)appeared in
+};
 
-   if(jack_connect (jack_client, jack_port_name (out_ports[0]), found_ports[0])){
-    fprintf(stderr, "cannot connect output ports\n");
+enum catalog_sort {
+  catalog_sort_finder = 0, //order the finder reported them in
+  catalog_sort_name,
+  catalog_sort_url
+};
+
+struct source_catalog {
+ public:
+  bool update(const NDIlib_source_t *sources, uint32_t no_sources); //returns true when the catalog changed
+  const catalog_source* find(uint64_t id, uint64_t generation, bool *stale);
+  const std::vector<catalog_source>& sources(void){ return m_sources; }
+  const std::vector<uint32_t>& order(catalog_sort sort);
+  uint64_t generation(void){ return m_generation; }
+  static uint64_t source_id(const char *name, const char *url);
+  static std::string id_string(uint64_t id);
+ private:
+  std::vector<catalog_source> m_sources; //in finder order
+  std::unordered_map<uint64_t, size_t> m_index; //id to position in m_sources
+  uint64_t m_generation = 1;
+  std::vector<uint32_t> m_order[3]; //positions in m_sources for each catalog_sort
+  uint64_t m_order_generation[3] = { 0, 0, 0 }; //generation each order was built for
+};
+
+static std::string lower_case(std::string text){
+  std::transform(text.begin(), text.end(), text.begin(), [](unsigned char ch){ return (char)tolower(ch); });
+  return text;
+}
+
+//Backslashes and quotes escaped for a JSON string - connection rules are regular expressions
+static std::string json_escape(const std::string &text){
+  std::string escaped;
+  for (char ch : text){
+   if((ch == '\\') || (ch == '"')){
+    escaped += '\\';
    }
+   escaped += ch;
+  }
+  return escaped;
+}
+
+//JACK servers as a JSON array of strings, for the page's server choice
+static std::string servers_json(void){
+  std::string json;
+  for (const std::string &server : jack_servers){
+   json += ((json == "") ? "\"" : ",\"") + json_escape(server) + "\"";
+  }
+  return json;
+}
 
-   if(jack_connect (jack_client, jack_port_name (out_ports[1]), found_ports[1])){
-    fprintf (stderr, "cannot connect output ports\n");
+//--jack-servers: comma separated names, "default" for the default server
+static void parse_jack_servers(const char *list){
+  std::vector<std::string> servers;
+  std::string names = list;
+  size_t start = 0;
+  while (start <= names.size()){
+   size_t comma = names.find(',', start);
+   if(comma == std::string::npos){
+    comma = names.size();
    }
+   std::string name = names.substr(start, comma - start);
+   start = comma + 1;
+   if(name == "default"){
+    name = "";
+   }
+   if(std::find(servers.begin(), servers.end(), name) == servers.end()){
+    servers.push_back(name);
+   }
+  }
+  jack_servers.swap(servers);
+}
 
-   jack_free (found_ports);
+//64 bit FNV-1a over the name, a separator and the URL
+uint64_t source_catalog::source_id(const char *name, const char *url){
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *p = name; p && *p; p++){
+   hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
   }
+  hash = (hash ^ 0xff) * 1099511628211ULL; //0xff never appears in UTF-8, so name and URL cannot run together
+  for (const char *p = url; p && *p; p++){
+   hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
+  }
+  return hash;
+}
 
-  // Create the receiver
-	m_pNDI_recv = NDIlib_recv_create_v3(&recv_create_desc);
-	assert(m_pNDI_recv);
+std::string source_catalog::id_string(uint64_t id){
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)id);
+  return buf;
+}
 
-  // Use a frame-synchronizer to ensure that the audio is dynamically resampled
-  m_pNDI_framesync = NDIlib_framesync_create(m_pNDI_recv); //starts in its own thread
+bool source_catalog::update(const NDIlib_source_t *sources, uint32_t no_sources){
+  bool changed = (no_sources != m_sources.size());
+  for (uint32_t i = 0; (i < no_sources) && !changed; i++){
+   changed = (source_id(sources[i].p_ndi_name, sources[i].p_url_address) != m_sources[i].id);
+  }
+  if(!changed){
+   return false;
+  }
+  m_generation++;
+  std::vector<catalog_source> next;
+  std::unordered_map<uint64_t, size_t> next_index;
+  next.reserve(no_sources);
+  for (uint32_t i = 0; i < no_sources; i++){
+   uint64_t id = source_id(sources[i].p_ndi_name, sources[i].p_url_address);
+   if(next_index.count(id)){ //the finder listed the same source twice
+    continue;
+   }
+   auto found = m_index.find(id);
+   uint64_t added = (found != m_index.end()) ? m_sources[found->second].added_generation : m_generation;
+   next_index[id] = next.size();
+   next.push_back({ id, sources[i].p_ndi_name ? sources[i].p_ndi_name : "", sources[i].p_url_address ? sources[i].p_url_address : "", "", added });
+   next.back().match_key = lower_case(next.back().name + "\n" + next.back().url);
+  }
+  m_sources.swap(next);
+  m_index.swap(next_index);
+  return true;
 }
 
-// Destructor
-receive_audio::~receive_audio(void){	// Wait for the thread to exit
-	m_exit = true;
-	jack_client_close(jack_client);
-	// Destroy the receiver
-  NDIlib_framesync_destroy(m_pNDI_framesync);
-	NDIlib_recv_destroy(m_pNDI_recv);
+/**
+ * Positions of the sources in the requested order. Sorted orders are built
+ * once per generation, so refreshes of an unchanged catalog do not sort.
+ */
+const std::vector<uint32_t>& source_catalog::order(catalog_sort sort){
+  std::vector<uint32_t> &order = m_order[sort];
+  if(m_order_generation[sort] == m_generation){
+   return order;
+  }
+  order.resize(m_sources.size());
+  for (uint32_t i = 0; i < order.size(); i++){
+   order[i] = i;
+  }
+  if(sort == catalog_sort_name){
+   std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b){ return m_sources[a].match_key < m_sources[b].match_key; });
+  }else if(sort == catalog_sort_url){
+   std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b){ return m_sources[a].url < m_sources[b].url; });
+  }
+  m_order_generation[sort] = m_generation;
+  return order;
 }
 
 /**
- * The process callback for this JACK application is called in a
- * special realtime thread once for each audio cycle.
+ * Look a source up by id for a client that last saw the catalog at
+ * generation. Returns NULL, with stale set, if the source has gone or has
+ * disappeared and come back since the client's list was built.
  */
-int process_callback(jack_nframes_t x, void *p){
- return static_cast<receive_audio*>(p)->process(x); 
+const catalog_source* source_catalog::find(uint64_t id, uint64_t generation, bool *stale){
+  auto found = m_index.find(id);
+  *stale = (found == m_index.end()) || (generation > m_generation) || (generation < m_sources[found->second].added_generation);
+  return *stale ? NULL : &m_sources[found->second];
+}
+
+source_catalog ndi_catalog; //updated from the finder on every refresh
+
+//Finder results, or a fixed list of made up sources when synthetic_sources is set
+static const NDIlib_source_t* get_current_sources(uint32_t *no_sources){
+  if(synthetic_sources <= 0){
+   return NDIlib_find_get_current_sources(pNDI_find, no_sources);
+  }
+  static std::vector<std::string> names;
+  static std::vector<NDIlib_source_t> sources;
+  if(sources.empty()){
+   names.reserve(synthetic_sources * 2);
+   for (int i = 0; i < synthetic_sources; i++){
+    names.push_back("STUDIO-" + std::to_string(i % 97) + " (Channel " + std::to_string(i) + ")");
+    names.push_back("10." + std::to_string((i >> 16) & 255) + "." + std::to_string((i >> 8) & 255) + "." + std::to_string(i & 255) + ":5961");
+   }
+   sources.resize(synthetic_sources);
+   for (int i = 0; i < synthetic_sources; i++){
+    sources[i].p_ndi_name = names[i * 2].c_str();
+    sources[i].p_url_address = names[i * 2 + 1].c_str();
+   }
+  }
+  *no_sources = sources.size();
+  return sources.data();
 }
 
 static const int no_receivers = 30; //max number of receivers
 receive_audio* p_receivers[no_receivers] = { 0 };
 std::string ndi_running_name[no_receivers] = { "" }; //name of the connected NDI stream
+mix_bus *p_mixer = NULL; //internal mixer, when enabled
+
+//Mute every receiver that is not soloed while any receiver is soloed
+static void update_receiver_solo(void){
+  bool any_solo = false;
+  for(uint32_t i = 0; i < no_receivers; i++){
+   if(p_receivers[i] && p_receivers[i]->m_solo){
+    any_solo = true;
+   }
+  }
+  for(uint32_t i = 0; i < no_receivers; i++){
+   if(p_receivers[i]){
+    p_receivers[i]->set_param(param_solo_mute, 0, (any_solo && !p_receivers[i]->m_solo) ? 1.0f : 0.0f);
+   }
+  }
+}
+
+//Under load the finder is read and the pages are updated less often - by load_level
+static const jack_time_t discovery_interval_us[] = { 0, 5000000, 15000000 };
+static const jack_time_t broadcast_interval_us[] = { 0, 2000000, 10000000 };
+
+//True when a reply should go to every page rather than only the asking one
+static bool broadcast_due(jack_time_t *last){
+  jack_time_t now = jack_get_time();
+  if(now - *last < broadcast_interval_us[jack_server_client::load_level()]){
+   return false;
+  }
+  *last = now;
+  return true;
+}
+
+struct sync_group_report {
+  int members; //receivers with a usable NDI timestamp
+  int64_t alignment_error_us; //spread of the smoothed playout ages after the delays
+  int64_t added_latency_us; //longest delay the group adds
+  int64_t jitter_us; //worst member's timestamp jitter
+};
+std::map<int, sync_group_report> sync_reports; //by sync group
+
+/**
+ * Line up the receivers of each sync group by NDI timestamp. Every receiver
+ * plays its audio at some age after the sender stamped it; the group plays
+ * at the age of its most delayed member and the others are held back in
+ * their delay lines by the difference. Ages are smoothed and a delay only
+ * moves once it is off by more than the jitter, so the group adds no more
+ * delay than needed and does not chase noise. The same ages give every
+ * receiver's port latency. Called from the control loop.
+ */
+static void update_sync_groups(void){
+  static jack_time_t last_update = 0;
+  jack_time_t now = jack_get_time();
+  if(now - last_update < 100000){ //ten times a second
+   return;
+  }
+  last_update = now;
+  int64_t wall_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t jack_offset_us = wall_us - (int64_t)now; //NDI timestamps are wall clock time
+  std::map<int, std::vector<receive_audio*>> groups;
+  for(uint32_t i = 0; i < no_receivers; i++){
+   receive_audio *receiver = p_receivers[i];
+   int64_t offset_us = 0;
+   if(!receiver){
+    continue;
+   }
+   if(!receiver->timestamp_offset(&offset_us)){ //no audio, or a sender without timestamps
+    receiver->m_sync_valid = false;
+    continue;
+   }
+   double age_us = (double)(jack_offset_us - offset_us);
+   if(!receiver->m_sync_valid){
+    receiver->m_sync_age_us = age_us;
+    receiver->m_sync_jitter_us = 0.0;
+    receiver->m_sync_valid = true;
+   }else{
+    double deviation = age_us - receiver->m_sync_age_us;
+    receiver->m_sync_age_us += 0.1 * deviation; //about a second to settle
+    receiver->m_sync_jitter_us += 0.1 * (fabs(deviation) - receiver->m_sync_jitter_us);
+   }
+   if(receiver->m_sync_group != 0){ //the age is measured for every receiver, it is also its latency
+    groups[receiver->m_sync_group].push_back(receiver);
+   }
+  }
+  sync_reports.clear();
+  for (auto &group : groups){
+   double target_us = 0.0;
+   double jitter_us = 0.0;
+   for (receive_audio *receiver : group.second){
+    target_us = std::max(target_us, receiver->m_sync_age_us);
+    jitter_us = std::max(jitter_us, receiver->m_sync_jitter_us);
+   }
+   double tolerance_us = std::max(250.0, 2.0 * jitter_us);
+   double earliest_us = 1e18;
+   double latest_us = -1e18;
+   sync_group_report report = { (int)group.second.size(), 0, 0, (int64_t)jitter_us };
+   for (receive_audio *receiver : group.second){
+    int64_t wanted_us = std::min((int64_t)(target_us - receiver->m_sync_age_us), (int64_t)max_delay_ms * 1000);
+    if(llabs(wanted_us - receiver->m_sync_delay_us) > (int64_t)tolerance_us){
+     receiver->m_sync_delay_us = wanted_us;
+     receiver->set_param(param_sync_delay, 0, (float)receiver->delay_samples(wanted_us));
+    }
+    double played_us = receiver->m_sync_age_us + receiver->m_sync_delay_us;
+    earliest_us = std::min(earliest_us, played_us);
+    latest_us = std::max(latest_us, played_us);
+    report.added_latency_us = std::max(report.added_latency_us, receiver->m_sync_delay_us);
+   }
+   report.alignment_error_us = (int64_t)(latest_us - earliest_us);
+   sync_reports[group.first] = report;
+  }
+  for(uint32_t i = 0; i < no_receivers; i++){
+   if(p_receivers[i]){
+    p_receivers[i]->update_latency();
+   }
+  }
+}
 
 static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
   if(ev == MG_EV_WS_OPEN){
     c->label[0] = 'W';  // Mark this connection as an established WS client
   }
   if (ev == MG_EV_HTTP_MSG){
+  trace_scope trace(trace_coarse, "http request");
   struct mg_http_message *hm = (struct mg_http_message *) ev_data;
   struct mg_connection *c2 = mgr.conns;
    if(mg_http_match_uri(hm, "/ws")){ //upgrade to WebSocket
       mg_ws_upgrade(c, hm, NULL);
+   }else if(mg_http_match_uri(hm, "/rtcheck")){ //calls the process callbacks should not make - only recorded in -DRT_CHECK builds
+      mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\n", rt_check_report().c_str());
+   }else if(mg_http_match_uri(hm, "/trace")){ //recent events of every thread, for chrome://tracing or ui.perfetto.dev
+      mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\n", trace_json().c_str());
    }else if(mg_http_match_uri(hm, "/rest")) { //handle REST events
       mg_http_reply(c, 200, "", "{\"result\": %d}\n", 123);
    }else{ // Serve static files
@@ -229,9 +2097,10 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
   }else if (ev == MG_EV_WS_MSG){
     // Got websocket frame. Received data is wm->data. Echo it back!
     struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
+    trace_scope trace(trace_coarse, "ws message");
     //std::cout << "WebSocket: " << wm->data.ptr << std::endl;
     char prefix_buf[100];
-    char action_buf[100];
+    char action_buf[512]; //long enough for connection rules
     mjson_get_string(wm->data.ptr, wm->data.len, "$.prefix", prefix_buf, sizeof(prefix_buf)); //get prefix
     mjson_get_string(wm->data.ptr, wm->data.len, "$.action", action_buf, sizeof(action_buf)); //get action
     std::string prefix_string = convertToString(prefix_buf);
@@ -241,39 +2110,63 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
     if(prefix_string == "refresh"){
      if(action_string == "refresh"){
 
-      uint32_t no_sources = 0; 
-      p_sources = NDIlib_find_get_current_sources(pNDI_find, &no_sources);
-      std::string discover_json;
+      //optional: "search":"<text>","sort":"name|url","page":"<n>","page_size":"<n>" - only the requested page is sent back
+      char search_buf[128] = "";
+      char sort_buf[16] = "";
+      char page_buf[16] = "";
+      char page_size_buf[16] = "";
+      mjson_get_string(wm->data.ptr, wm->data.len, "$.search", search_buf, sizeof(search_buf));
+      mjson_get_string(wm->data.ptr, wm->data.len, "$.sort", sort_buf, sizeof(sort_buf));
+      mjson_get_string(wm->data.ptr, wm->data.len, "$.page", page_buf, sizeof(page_buf));
+      mjson_get_string(wm->data.ptr, wm->data.len, "$.page_size", page_size_buf, sizeof(page_size_buf));
+      std::string search = lower_case(search_buf);
+      catalog_sort sort = (strcmp(sort_buf, "name") == 0) ? catalog_sort_name : ((strcmp(sort_buf, "url") == 0) ? catalog_sort_url : catalog_sort_finder);
+      uint32_t page = strtoul(page_buf, NULL, 10);
+      uint32_t page_size = std::min(std::max((uint32_t)strtoul(page_size_buf, NULL, 10), (uint32_t)1), (uint32_t)500);
+      if(page_size_buf[0] == 0){
+       page_size = 50;
+      }
+
+      jack_time_t build_start = jack_get_time();
+      int load_level = jack_server_client::load_level();
+      static jack_time_t last_discovery = 0;
+      if(build_start - last_discovery >= discovery_interval_us[load_level]){ //under load the catalog is refreshed less often
+       uint32_t no_sources = 0; 
+       p_sources = get_current_sources(&no_sources);
+       ndi_catalog.update(p_sources, no_sources);
+       last_discovery = build_start;
+      }
+      std::unordered_map<std::string, int> running; //receivers already on each source - another can share the connection
+      for(uint32_t i = 0; i < no_receivers; i++){
+       if(ndi_running_name[i] != ""){
+        running[ndi_running_name[i]]++;
+       }
+      }
+      const std::vector<catalog_source> &catalog = ndi_catalog.sources();
       std::string source_json = "";
-      discover_json = "{\"prefix\":\"discover_source\",\"action\":\"display\",\"source_list\":{";
-      for(uint32_t i = 0; i < no_sources; i++){
-       std::string ndi_string = p_sources[i].p_ndi_name;
-       std::string url_string = p_sources[i].p_url_address;
-       std::string source_id = std::to_string(i); 
-       int conflict = 0;
-       for(uint32_t i = 0; i < no_receivers; i++){ //check for conflicts
-        if((ndi_running_name[i] == ndi_string)&&(conflict == 0)){
-         conflict = 1; //found conflict with a name that is already stored - already running this receiver
-        }  
+      uint32_t matched = 0;
+      uint32_t first = page * page_size;
+      for(uint32_t index : ndi_catalog.order(sort)){
+       const catalog_source &source = catalog[index];
+       if(!search.empty() && (source.match_key.find(search) == std::string::npos)){
+        continue;
        }
-       if(conflict == 0){ //since this is not running on a receiver - display
-        //std::cout << "Source IP: " << p_sources[i].p_url_address << std::endl;
-        if(source_json == ""){
-         source_json += "\""+source_id + "\":{\"name\":\""+ndi_string+"\",\"url\":\""+url_string+"\"}";  
-        }else{
-         source_json += ",\""+source_id + "\":{\"name\":\""+ndi_string+"\",\"url\":\""+url_string+"\"}";  
+       if((matched >= first) && (matched < first + page_size)){
+        if(source_json != ""){
+         source_json += ",";
         }
+        auto receivers = running.find(source.name);
+        source_json += "\""+source_catalog::id_string(source.id) + "\":{\"name\":\""+source.name+"\",\"url\":\""+source.url+
+                       "\",\"receivers\":\""+std::to_string((receivers != running.end()) ? receivers->second : 0)+"\"}";  
        }
+       matched++;
       }
-      discover_json += source_json;
-      discover_json += "}";
-      discover_json += "}";
-      const char* pub_json1 = discover_json.c_str();
-      for (struct mg_connection *c2 = mgr.conns; c2 != NULL; c2 = c2->next) { //traverse over all client connections
-       if (c2->label[0] == 'W'){ //make sure it is a websocket connection
-        mg_ws_send(c2, pub_json1, strlen(pub_json1), WEBSOCKET_OP_TEXT);
-       }
-      }
+      std::string discover_json = "{\"prefix\":\"discover_source\",\"action\":\"display\",\"generation\":\""+std::to_string(ndi_catalog.generation())+
+                                  "\",\"total\":\""+std::to_string(catalog.size())+"\",\"matched\":\""+std::to_string(matched)+
+                                  "\",\"page\":\""+std::to_string(page)+"\",\"page_size\":\""+std::to_string(page_size)+
+                                  "\",\"build_us\":\""+std::to_string(jack_get_time() - build_start)+"\",\"servers\":["+servers_json()+"],\"load_level\":\""+std::to_string(load_level)+
+                                  "\",\"source_list\":{"+source_json+"}}";
+      mg_ws_send(c, discover_json.c_str(), discover_json.size(), WEBSOCKET_OP_TEXT); //each page has its own filter, so only the asking page gets it
 
       std::string connected_json;
       source_json = "";
@@ -281,10 +2174,13 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
       for(uint32_t i = 0; i < no_receivers; i++){
        if(ndi_running_name[i] != ""){ //make sure receiver is not empty
         std::string source_id = std::to_string(i); 
+        std::string params_json = ",\"layout\":\""+p_receivers[i]->m_layout+"\",\"gain\":\""+std::to_string(p_receivers[i]->m_gain)+"\",\"mute\":\""+std::to_string(p_receivers[i]->m_mute)+"\",\"solo\":\""+std::to_string(p_receivers[i]->m_solo)+
+                                  "\",\"sync_group\":\""+std::to_string(p_receivers[i]->m_sync_group)+"\",\"delay_ms\":\""+std::to_string(p_receivers[i]->delay_ms())+
+                                  "\",\"connect_rules\":\""+json_escape(p_receivers[i]->m_connect_rules)+"\",\"server\":\""+json_escape(p_receivers[i]->m_server_name)+"\"";
         if(source_json == ""){
-         source_json += "\""+source_id + "\":{\"name\":\""+ndi_running_name[i]+"\"}";  
+         source_json += "\""+source_id + "\":{\"name\":\""+ndi_running_name[i]+"\""+params_json+"}";  
         }else{
-         source_json += ",\""+source_id + "\":{\"name\":\""+ndi_running_name[i]+"\"}";  
+         source_json += ",\""+source_id + "\":{\"name\":\""+ndi_running_name[i]+"\""+params_json+"}";  
         }
        }
       }
@@ -292,12 +2188,49 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
       connected_json += "}";
       connected_json += "}";
       const char* pub_json2 = connected_json.c_str();
+      static jack_time_t last_playing_broadcast = 0;
+      bool broadcast = broadcast_due(&last_playing_broadcast); //under load only the asking page is answered between broadcasts
       for (struct mg_connection *c2 = mgr.conns; c2 != NULL; c2 = c2->next) { //traverse over all client connections
-       if (c2->label[0] == 'W'){ //make sure it is a websocket connection
+       if ((c2->label[0] == 'W') && (broadcast || (c2 == c))){ //make sure it is a websocket connection
         mg_ws_send(c2, pub_json2, strlen(pub_json2), WEBSOCKET_OP_TEXT);
        }
       }
      }
+     if((action_string == "re_mix") && p_mixer){ //send the mixer matrix and its process timing
+      std::string mix_json = p_mixer->matrix_json();
+      for (struct mg_connection *c2 = mgr.conns; c2 != NULL; c2 = c2->next) { //traverse over all client connections
+       if (c2->label[0] == 'W'){ //make sure it is a websocket connection
+        mg_ws_send(c2, mix_json.c_str(), mix_json.size(), WEBSOCKET_OP_TEXT);
+       }
+      }
+     }
+     if(action_string == "re_stats"){ //per receiver dropout counters
+      std::string stats_json = "";
+      for(uint32_t i = 0; i < no_receivers; i++){
+       if(p_receivers[i]){
+        if(stats_json != ""){
+         stats_json += ",";
+        }
+        stats_json += "\""+std::to_string(i)+"\":{\"name\":\""+ndi_running_name[i]+"\",\"stats\":"+p_receivers[i]->stats_json()+"}";
+       }
+      }
+      std::string groups_json = "";
+      for (auto &report : sync_reports){
+       if(groups_json != ""){
+        groups_json += ",";
+       }
+       groups_json += "\""+std::to_string(report.first)+"\":{\"members\":\""+std::to_string(report.second.members)+"\",\"alignment_error_us\":\""+std::to_string(report.second.alignment_error_us)+
+                      "\",\"added_latency_us\":\""+std::to_string(report.second.added_latency_us)+"\",\"jitter_us\":\""+std::to_string(report.second.jitter_us)+"\"}";
+      }
+      stats_json = "{\"prefix\":\"receiver_stats\",\"action\":\"display\",\"receivers\":{"+stats_json+"},\"sync_groups\":{"+groups_json+"}}";
+      static jack_time_t last_stats_broadcast = 0;
+      bool broadcast = broadcast_due(&last_stats_broadcast);
+      for (struct mg_connection *c2 = mgr.conns; c2 != NULL; c2 = c2->next) { //traverse over all client connections
+       if ((c2->label[0] == 'W') && (broadcast || (c2 == c))){ //make sure it is a websocket connection
+        mg_ws_send(c2, stats_json.c_str(), stats_json.size(), WEBSOCKET_OP_TEXT);
+       }
+      }
+     }
      if(action_string == "re_vol"){
       std::string volume_json;
       std::string source_json = "";
@@ -319,46 +2252,90 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
      } 
     }
 
+    //{"prefix":"connect_source","action":"<source id>","generation":"<catalog generation>","layout":"<layout>","server":"<JACK server>"}
     if(prefix_string == "connect_source"){
-     int source_id = std::stoi(action_string);
+     char layout_buf[256] = ""; //optional channel subset or downmix, see parse_channel_layout()
+     char generation_buf[24] = "";
+     char server_buf[128] = ""; //one of --jack-servers, the default server if empty
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.layout", layout_buf, sizeof(layout_buf));
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.server", server_buf, sizeof(server_buf));
+     if(std::find(jack_servers.begin(), jack_servers.end(), std::string(server_buf)) == jack_servers.end()){
+      fprintf(stderr, "connect to unknown JACK server %s ignored\n", server_buf);
+      return;
+     }
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.generation", generation_buf, sizeof(generation_buf));
+     bool stale = false;
+     const catalog_source *source = ndi_catalog.find(strtoull(action_string.c_str(), NULL, 16), strtoull(generation_buf, NULL, 10), &stale);
+     if(stale){ //the page is showing an old list - it redraws on the refresh that follows
+      fprintf(stderr, "connect to stale source %s (generation %s) ignored\n", action_string.c_str(), generation_buf);
+      std::string stale_json = "{\"prefix\":\"connect_source\",\"action\":\"stale\",\"source\":\""+action_string+"\"}";
+      mg_ws_send(c, stale_json.c_str(), stale_json.size(), WEBSOCKET_OP_TEXT);
+      return;
+     }
      int stored = 0;
      int receiver_id = 0;
-     int conflict = 0;
-     std::string ndi_string = p_sources[source_id].p_ndi_name;
-     for(uint32_t i = 0; i < no_receivers; i++){ //check for conflicts
-      if((ndi_running_name[i] == ndi_string)&&(conflict == 0)){
-       conflict = 1; //found conflict with a name that is already stored - already running this receiver
-      }  
+     int source_channels = 0; //known already if another receiver shares this source
+     std::string ndi_string = source->name;
+     for(uint32_t i = 0; i < no_receivers; i++){ //the same source can be received again with its own layout and gain
+      if((ndi_running_name[i] == ndi_string) && p_receivers[i]){
+       source_channels = std::max(source_channels, p_receivers[i]->source_channels());
+      }
      }
-     if(conflict == 0){
-      for(uint32_t i = 0; i < no_receivers; i++){
-       if(stored == 0){
-        if(ndi_running_name[i] == ""){ //empty string array
-         ndi_running_name[i] = ndi_string;
-         std::cout << "ID: " << i << std::endl;
-         stored = 1;
-         receiver_id = i;
-        } 
-       }
+     for(uint32_t i = 0; i < no_receivers; i++){
+      if(stored == 0){
+       if(ndi_running_name[i] == ""){ //empty string array
+        ndi_running_name[i] = ndi_string;
+        std::cout << "ID: " << i << std::endl;
+        stored = 1;
+        receiver_id = i;
+       } 
+      }
+     }
+     if(stored == 1){
+      if(source_channels <= 0){ //first receiver of this source - ask the source
+       get_ndi_info(ndi_string.c_str());
+       source_channels = stream_info[2];
       }
-      get_ndi_info(p_sources[source_id].p_ndi_name);
-      p_receivers[receiver_id] = new receive_audio(p_sources[source_id].p_ndi_name, "NDI_recv", stream_info[2]); 
+      p_receivers[receiver_id] = new receive_audio(ndi_string.c_str(), "NDI_recv", source_channels, layout_buf, "", server_buf); 
+      update_receiver_solo(); //a new receiver starts muted if something else is soloed
      }else{
-      //std::cout << "Receiver already running for:  " << p_sources[source_id].p_ndi_name << std::endl; 
+      fprintf(stderr, "All %d receivers are in use\n", no_receivers);
      }
     }
 
     if(prefix_string == "disconnect_source"){ //remove a connected source
      int source_id = std::stoi(action_string);
+     if(p_mixer && p_receivers[source_id]){ //stop mixing the receiver before it goes away
+      p_mixer->remove_feed(p_receivers[source_id]->m_mix_feed);
+     }
      delete p_receivers[source_id]; //delete receiver
+     p_receivers[source_id] = NULL;
      ndi_running_name[source_id] = ""; //update the running receiver
+     update_receiver_solo(); //removing a soloed receiver unmutes the others
     }
 
     if(prefix_string == "save_streams"){ //save the current connected streams
      std::ofstream preset_file("/opt/ndi2jack/assets/presets.txt");
      for(uint32_t i = 0; i < no_receivers; i++){
       if(ndi_running_name[i] != ""){ //make sure a receiver is stored before trying to save in file
-      preset_file << ndi_running_name[i];
+      //the channel layout, sync group, delay, connection rules and JACK server follow the name after tabs, up to the last one that is set
+      std::vector<std::string> fields = { ndi_running_name[i], p_receivers[i]->m_layout, std::to_string(p_receivers[i]->m_sync_group),
+                                          std::to_string(p_receivers[i]->m_delay_samples) + "s", p_receivers[i]->m_connect_rules, p_receivers[i]->m_server_name }; //samples, so the delay survives a sample rate change
+      size_t used = 1;
+      if(p_receivers[i]->m_server_name != ""){
+       used = 6;
+      }else if(p_receivers[i]->m_connect_rules != ""){
+       used = 5;
+      }else if(p_receivers[i]->m_delay_samples != 0){
+       used = 4;
+      }else if(p_receivers[i]->m_sync_group != 0){
+       used = 3;
+      }else if(p_receivers[i]->m_layout != ""){
+       used = 2;
+      }
+      for (size_t field = 0; field < used; field++){
+       preset_file << ((field > 0) ? "\t" : "") << fields[field];
+      }
       preset_file << std::endl;
       }
      }
@@ -367,6 +2344,103 @@ static void fn(struct mg_connection *c, int ev, void *ev_data, void *fn_data){
 
     if(prefix_string == "am"){ //adjust the main volume - all output channels are adjusted
      main_volume = std::stof(action_string); //get the float volume from the websocket and set the main_volume variable
+     for(uint32_t i = 0; i < no_receivers; i++){
+      if(p_receivers[i]){
+       p_receivers[i]->set_param(param_main_gain, 0, main_volume);
+      }
+     }
+    }
+
+    //connection rules: {"prefix":"connect_rules","action":"<[first[-last]=]regex;...>","receiver":"<id>"} - empty for the default
+    if(prefix_string == "connect_rules"){
+     char receiver_buf[16] = "";
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.receiver", receiver_buf, sizeof(receiver_buf));
+     int receiver_id = atoi(receiver_buf);
+     if((receiver_id >= 0) && (receiver_id < no_receivers) && p_receivers[receiver_id]){
+      if(!p_receivers[receiver_id]->set_connect_rules(action_string)){
+       std::string error_json = "{\"prefix\":\"connect_rules\",\"action\":\"invalid\",\"receiver\":\""+std::to_string(receiver_id)+"\"}";
+       mg_ws_send(c, error_json.c_str(), error_json.size(), WEBSOCKET_OP_TEXT);
+      }
+     }
+    }
+
+    //sync groups: {"prefix":"sync","action":"<group, 0 for none>","receiver":"<id>"}
+    if(prefix_string == "sync"){
+     char receiver_buf[16] = "";
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.receiver", receiver_buf, sizeof(receiver_buf));
+     int receiver_id = atoi(receiver_buf);
+     if((receiver_id >= 0) && (receiver_id < no_receivers) && p_receivers[receiver_id]){
+      receive_audio *receiver = p_receivers[receiver_id];
+      receiver->m_sync_group = std::max(0, atoi(action_string.c_str()));
+      receiver->m_sync_valid = false; //start measuring afresh
+      receiver->m_sync_delay_us = 0;
+      receiver->set_param(param_sync_delay, 0, 0.0f);
+     }
+    }
+
+    //user delay: {"prefix":"delay","action":"<delay>","receiver":"<id>","unit":"ms|samples"} - ms by default
+    if(prefix_string == "delay"){
+     char receiver_buf[16] = "";
+     char unit_buf[16] = "";
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.receiver", receiver_buf, sizeof(receiver_buf));
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.unit", unit_buf, sizeof(unit_buf));
+     int receiver_id = atoi(receiver_buf);
+     if((receiver_id >= 0) && (receiver_id < no_receivers) && p_receivers[receiver_id]){
+      receive_audio *receiver = p_receivers[receiver_id];
+      double value = atof(action_string.c_str());
+      receiver->set_delay((strcmp(unit_buf, "samples") == 0) ? (int)value : receiver->delay_samples((int64_t)(value * 1000.0)));
+     }
+    }
+
+    //mixer gains: {"prefix":"mix","action":"<gain>","receiver":"<id>","channel":"<channel>","bus":"<bus>"}
+    if((prefix_string == "mix") && p_mixer){
+     char receiver_buf[16] = "";
+     char channel_buf[16] = "";
+     char bus_buf[16] = "";
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.receiver", receiver_buf, sizeof(receiver_buf));
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.channel", channel_buf, sizeof(channel_buf));
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.bus", bus_buf, sizeof(bus_buf));
+     int receiver_id = atoi(receiver_buf);
+     if((receiver_id >= 0) && (receiver_id < no_receivers) && p_receivers[receiver_id]){
+      p_mixer->set_gain(p_receivers[receiver_id]->m_mix_feed, receiver_id, atoi(channel_buf), atoi(bus_buf), std::stof(action_string));
+     }
+    }
+
+    //receiver parameters: {"prefix":"rg|rm|rs","action":"<value>","receiver":"<id>","channel":"<channel>"}
+    //rg sets gain, rm mutes and rs solos - without a channel the whole receiver is changed
+    if((prefix_string == "rg") || (prefix_string == "rm") || (prefix_string == "rs")){
+     char receiver_buf[16] = "";
+     char channel_buf[16] = "";
+     mjson_get_string(wm->data.ptr, wm->data.len, "$.receiver", receiver_buf, sizeof(receiver_buf));
+     bool channel_param = mjson_get_string(wm->data.ptr, wm->data.len, "$.channel", channel_buf, sizeof(channel_buf)) > 0;
+     int receiver_id = atoi(receiver_buf);
+     float value = std::stof(action_string);
+     if((receiver_id >= 0) && (receiver_id < no_receivers) && p_receivers[receiver_id]){
+      receive_audio *receiver = p_receivers[receiver_id];
+      int channel = atoi(channel_buf);
+      if(prefix_string == "rg"){
+       if(channel_param){
+        receiver->set_param(param_channel_gain, channel, value);
+       }else{
+        receiver->m_gain = value;
+        receiver->set_param(param_gain, 0, value);
+       }
+      }else if(prefix_string == "rm"){
+       if(channel_param){
+        receiver->set_param(param_channel_mute, channel, value);
+       }else{
+        receiver->m_mute = (value != 0.0f);
+        receiver->set_param(param_mute, 0, value);
+       }
+      }else{
+       if(channel_param){
+        receiver->set_param(param_channel_solo, channel, value);
+       }else{
+        receiver->m_solo = (value != 0.0f);
+        update_receiver_solo();
+       }
+      }
+     }
     }
     
   }
@@ -377,6 +2451,7 @@ bool get_ndi_info(const char* source){
   recv_create_desc.source_to_connect_to = source;
   recv_create_desc.bandwidth = NDIlib_recv_bandwidth_audio_only; //specify receiving audio frames only
   recv_create_desc.p_ndi_recv_name = "NDI Info";
+  rt_thread_scope scope(rt_threads, "ndi");
   pNDI_recv = NDIlib_recv_create_v3(&recv_create_desc); //create a receiver that connects to the source
 	assert(pNDI_recv);
 	NDIlib_audio_frame_v3_t audio_frame;
@@ -422,16 +2497,30 @@ static void usage(FILE *fp, int argc, char **argv){
                  "Options:\n"
                  "-h | --help          Print this message\n"
                  "-a | --auto-connect  Disable auto connect JACK ports (default to true)\n"
+                 "-b | --mix-buses     Enable the internal mixer with N bus outputs\n"
+                 "-g | --groups        NDI groups to search, comma separated (default public)\n"
+                 "-e | --extra-ips     Comma separated IPs of NDI senders on other subnets to query\n"
+                 "-y | --synthetic-sources  List N made up sources instead of the finder's, for load testing\n"
+                 "-j | --jack-servers  Comma separated JACK servers receivers can play to (default to the default server)\n"
+                 "-A | --affinity      CPUs and priority per thread role: control=0;ndi=1-2@0\n"
+                 "-T | --trace         Trace detail off, coarse or fine, served at /trace or dumped on SIGUSR1 (default coarse)\n"
                  "",
                  argv[0]);
 }
 
-static const char short_options[] = "a";
+static const char short_options[] = "ab:g:e:y:j:A:T:";
 
 static const struct option
 long_options[] = {
         { "help",   no_argument,       NULL, 'h' },
         { "auto-connect", no_argument,       NULL, 'a' },
+        { "mix-buses", required_argument, NULL, 'b' },
+        { "groups", required_argument, NULL, 'g' },
+        { "extra-ips", required_argument, NULL, 'e' },
+        { "synthetic-sources", required_argument, NULL, 'y' },
+        { "jack-servers", required_argument, NULL, 'j' },
+        { "affinity", required_argument, NULL, 'A' },
+        { "trace", required_argument, NULL, 'T' },
         { 0, 0, 0, 0 }
 };
 
@@ -449,12 +2538,42 @@ int main (int argc, char *argv[]){
      exit(EXIT_SUCCESS);
     case 'a':
      auto_connect_jack_ports = false;
-     break;           
+     break;
+    case 'b':
+     mix_buses = atoi(optarg);
+     break;
+    case 'g':
+     NDI_find_create_desc.p_groups = optarg; //argv outlives the finder
+     break;
+    case 'e':
+     NDI_find_create_desc.p_extra_ips = optarg;
+     break;
+    case 'y':
+     synthetic_sources = atoi(optarg);
+     break;
+    case 'j':
+     parse_jack_servers(optarg);
+     break;
+    case 'A':
+     if(!rt_threads.parse(optarg, { "control", "ndi" })){
+      usage(stderr, argc, argv);
+      exit(EXIT_FAILURE);
+     }
+     break;
+    case 'T':
+     if(!trace_parse_level(optarg)){
+      usage(stderr, argc, argv);
+      exit(EXIT_FAILURE);
+     }
+     break;
     default:
      usage(stderr, argc, argv);
      exit(EXIT_FAILURE);
    }
   }
+  rt_threads.lock_memory(); //before any receiver allocates its buffers
+  rt_threads.apply("control"); //layout and supervising threads inherit this
+  trace_install_signal();
 
   if(!NDIlib_initialize()){	
 	 printf("Cannot run NDI."); // Cannot run NDI. Most likely because the CPU is not sufficient.
@@ -463,14 +2582,34 @@ int main (int argc, char *argv[]){
 
 	// Create a NDI finder	
   NDI_find_create_desc.show_local_sources = (bool)false; //don't include local sources when searching for NDI
-	pNDI_find = NDIlib_find_create_v2(&NDI_find_create_desc);
+	{
+	 rt_thread_scope scope(rt_threads, "ndi"); //the finder's threads too
+	 pNDI_find = NDIlib_find_create_v2(&NDI_find_create_desc);
+	}
 	if (!pNDI_find) return 0; //error out if the NDI finder can't be created
 
+  if(mix_buses > 0){ //the mixer must exist before any receiver so they all get a feed
+   p_mixer = new mix_bus(mix_buses);
+  }
+
   std::string output_text; //preset file is temporary stored in this variable
   std::ifstream preset_file("/opt/ndi2jack/assets/presets.txt"); //open the presets file
   while(getline(preset_file, output_text)){
    int stored = 0;
    int receiver_id = 0;
+   std::vector<std::string> fields; //name followed by a channel layout and optionally a sync group, delay, connection rules and JACK server
+   size_t start = 0;
+   size_t tab;
+   while ((tab = output_text.find('\t', start)) != std::string::npos){
+    fields.push_back(output_text.substr(start, tab - start));
+    start = tab + 1;
+   }
+   fields.push_back(output_text.substr(start));
+   fields.resize(std::max(fields.size(), (size_t)6));
+   output_text = fields[0];
+   std::string layout_string = fields[1];
+   int sync_group = atoi(fields[2].c_str());
+   std::string delay_string = fields[3];
    const char* ndi_name = output_text.c_str();;
    std::string ndi_string = ndi_name;
    for(uint32_t i = 0; i < no_receivers; i++){
@@ -482,12 +2621,25 @@ int main (int argc, char *argv[]){
      } 
     }
    }
-   p_receivers[receiver_id] = new receive_audio(ndi_name, "NDI_recv", 2); //2 channels by default
+   if(std::find(jack_servers.begin(), jack_servers.end(), fields[5]) == jack_servers.end()){ //saved with a server not given this time - keep it playing there
+    jack_servers.push_back(fields[5]);
+   }
+   p_receivers[receiver_id] = new receive_audio(ndi_name, "NDI_recv", 2, layout_string.c_str(), fields[4].c_str(), fields[5].c_str()); //2 channels by default
+   p_receivers[receiver_id]->m_sync_group = sync_group;
+   if(delay_string != ""){ //"480s" is in samples, "10" or "10ms" in milliseconds
+    double delay = atof(delay_string.c_str());
+    bool samples = (delay_string.back() == 's') && (delay_string.find("ms") == std::string::npos);
+    p_receivers[receiver_id]->set_delay(samples ? (int)delay : p_receivers[receiver_id]->delay_samples((int64_t)(delay * 1000.0)));
+   }
   }
                                
   mg_mgr_init(&mgr);
   mg_http_listen(&mgr, "ws://0.0.0.0:80", fn, NULL);   // Create WebSocket and HTTP connection
-  for (;;) mg_mgr_poll(&mgr, 1000);  // Block forever
+  for (;;){ // Block forever
+   mg_mgr_poll(&mgr, 100);
+   update_sync_groups(); //on this thread so receivers cannot be deleted under it
+   trace_poll_signal("ndi2jack");
+  }
   /* keep running until the Ctrl+C */
   while(1){
    sleep(1);
@@ -0,0 +1,164 @@
+/*
+ * Polyphase sample rate converter for planar float audio
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audio_kernels.h"
+
+enum resampler_quality {
+  resampler_quality_low = 0, //16 taps - 44.1k to 48k: 0.1dB ripple to 15kHz, -67dB images
+  resampler_quality_medium,  //32 taps - 0.1dB ripple to 18kHz, -78dB images
+  resampler_quality_high     //64 taps - 0.2dB ripple to 20kHz, -86dB images
+};
+
+struct resampler {
+ resampler(void): m_up(1), m_down(1), m_taps(0), m_channels(0), m_max_in(0), m_fill(0), m_pos(0), m_coeffs(NULL), m_history(NULL){}
+ ~resampler(void){ free(m_coeffs); free(m_history); }
+ public:
+  /**
+   * Build the filter bank for converting in_rate to out_rate. max_in is the
+   * largest block (samples per channel) that process() will be handed.
+   * Returns false if the ratio cannot be expressed with a sensible number
+   * of polyphase filters.
+   */
+  bool setup(int in_rate, int out_rate, int channels, int max_in, resampler_quality quality){
+   static const int quality_taps[] = { 16, 32, 64 };
+   static const double quality_rolloff[] = { 0.88, 0.93, 0.96 }; //filter cutoff as a fraction of the lower Nyquist
+   static const double quality_beta[] = { 6.0, 7.0, 8.0 }; //Kaiser window shape
+   int divisor = gcd(in_rate, out_rate);
+   if((in_rate <= 0) || (out_rate <= 0) || (out_rate / divisor > 1024)){
+    return false;
+   }
+   free(m_coeffs);
+   free(m_history);
+   m_up = out_rate / divisor;
+   m_down = in_rate / divisor;
+   m_taps = quality_taps[quality];
+   m_channels = channels;
+   m_max_in = max_in;
+   m_coeffs = (float*)malloc(sizeof(float) * m_up * m_taps);
+   m_history = (float*)malloc(sizeof(float) * history_size() * m_channels);
+   if((m_coeffs == NULL) || (m_history == NULL)){
+    return false;
+   }
+
+   //windowed sinc, one filter per output phase, each normalised to unity gain
+   double cutoff = ((m_up < m_down) ? (double)m_up / m_down : 1.0) * quality_rolloff[quality];
+   double half_width = m_taps / 2;
+   for (int phase = 0; phase < m_up; phase++){
+    float *p_coeffs = m_coeffs + phase * m_taps;
+    double sum = 0.0;
+    for (int tap = 0; tap < m_taps; tap++){
+     double distance = tap - (half_width - 1) - (double)phase / m_up; //input samples from the output point
+     double x = M_PI * cutoff * distance;
+     double sinc = (x == 0.0) ? 1.0 : sin(x) / x;
+     double ratio = distance / half_width;
+     double window = bessel_i0(quality_beta[quality] * sqrt(fmax(0.0, 1.0 - ratio * ratio))) / bessel_i0(quality_beta[quality]);
+     p_coeffs[tap] = (float)(sinc * window);
+     sum += p_coeffs[tap];
+    }
+    for (int tap = 0; tap < m_taps; tap++){
+     p_coeffs[tap] = (float)(p_coeffs[tap] / sum);
+    }
+   }
+   reset();
+   return true;
+  }
+
+  //Forget the signal history, e.g. after a gap in the input
+  void reset(void){
+   m_fill = m_taps / 2 - 1; //prime with zeros so output lines up with the input timeline
+   m_pos = 0;
+   memset(m_history, 0, sizeof(float) * history_size() * m_channels);
+  }
+
+  //Input samples held back until enough follow for the filter - the latency the converter adds
+  int delay(void){
+   return m_taps / 2 + 1;
+  }
+
+  //Most samples per channel that process() can return for max_in input samples
+  int max_output(void){
+   return (int)(((int64_t)(m_max_in + m_taps) * m_up) / m_down) + 2;
+  }
+
+  /**
+   * Convert no_in samples per channel from planar in (channel stride
+   * in_stride samples) into planar out (channel stride out_stride samples).
+   * Returns the number of samples written per channel, which varies from
+   * block to block when the ratio is not an integer.
+   */
+  int process(const float *in, int in_stride, int no_in, float *out, int out_stride){
+   if(no_in > m_max_in){
+    no_in = m_max_in;
+   }
+   int available = m_fill + no_in;
+   int no_out = 0;
+   uint64_t pos = m_pos;
+   for (int channel = 0; channel < m_channels; channel++){
+    float *p_history = m_history + channel * history_size();
+    float *p_out = out + channel * out_stride;
+    memcpy(p_history + m_fill, in + channel * in_stride, sizeof(float) * no_in);
+    pos = m_pos;
+    no_out = 0;
+    while ((int)(pos / m_up) + m_taps <= available){
+     p_out[no_out++] = dot_product(p_history + pos / m_up, m_coeffs + (pos % m_up) * m_taps, m_taps);
+     pos += m_down;
+    }
+   }
+   //keep the samples the next output still needs
+   int consumed = (int)(pos / m_up);
+   if(consumed > available){
+    consumed = available;
+   }
+   for (int channel = 0; channel < m_channels; channel++){
+    float *p_history = m_history + channel * history_size();
+    memmove(p_history, p_history + consumed, sizeof(float) * (available - consumed));
+   }
+   m_fill = available - consumed;
+   m_pos = pos - (uint64_t)consumed * m_up;
+   return no_out;
+  }
+
+ private:
+  int m_up; //interpolation factor (output rate / gcd)
+  int m_down; //decimation factor (input rate / gcd)
+  int m_taps; //filter taps per phase
+  int m_channels;
+  int m_max_in;
+  int m_fill; //samples per channel waiting at the start of the history
+  uint64_t m_pos; //next output position in 1/m_up input samples
+  float *m_coeffs; //m_up filters of m_taps each
+  float *m_history; //per channel: leftover samples followed by the new block
+
+  int history_size(void){ return m_max_in + m_taps; }
+
+  static int gcd(int a, int b){
+   while (b != 0){
+    int t = a % b;
+    a = b;
+    b = t;
+   }
+   return a;
+  }
+
+  static double bessel_i0(double x){ //modified Bessel function of the first kind, order 0
+   double sum = 1.0;
+   double term = 1.0;
+   for (int k = 1; k < 32; k++){
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+   }
+   return sum;
+  }
+};
+
+#endif
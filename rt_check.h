@@ -0,0 +1,292 @@
+/*
+ * Debug build mode that traps calls the JACK process callbacks must not make
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef RT_CHECK_H
+#define RT_CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * Built with -DRT_CHECK (add -rdynamic for function names in the
+ * backtraces), the program interposes malloc, free, pthread_mutex_lock,
+ * write and the stdio calls that write out, and records any call made while
+ * an rt_check_scope is open - the process callbacks open one for the length
+ * of the cycle. Each call site is counted once per distinct backtrace, so
+ * the report shows where the hot path allocates or blocks and how often.
+ * Without RT_CHECK the scope compiles away.
+ */
+#ifdef RT_CHECK
+
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <atomic>
+
+enum rt_check_call {
+  rt_check_malloc = 0,
+  rt_check_free,
+  rt_check_mutex,
+  rt_check_write,
+  rt_check_stdio
+};
+
+static const int rt_check_sites = 256; //distinct call sites kept - later ones are only counted
+static const int rt_check_depth = 24; //backtrace frames kept per site
+
+struct rt_check_site {
+  std::atomic<uint64_t> key; //hash of the call and backtrace, 0 while free
+  std::atomic<bool> ready; //frames are filled in
+  std::atomic<uint64_t> count;
+  int call;
+  int frames;
+  void *trace[rt_check_depth];
+};
+
+static rt_check_site rt_check_table[rt_check_sites]; //zeroed before any constructor runs
+static std::atomic<uint64_t> rt_check_total(0);
+static std::atomic<uint64_t> rt_check_overflow(0); //calls from sites the table had no room for
+static std::atomic<int> rt_check_sites_used(0); //distinct call sites recorded
+static __thread int rt_check_open = 0; //rt_check_scopes open in this thread
+static __thread bool rt_check_busy = false; //recording - backtrace() itself may land in the hooks
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static void rt_check_record(int call){
+  if((rt_check_open == 0) || rt_check_busy){
+   return;
+  }
+  rt_check_busy = true;
+  void *trace[rt_check_depth];
+  int frames = backtrace(trace, rt_check_depth);
+  uint64_t key = 1469598103934665603ULL ^ (uint64_t)call; //FNV-1a over the call and the return addresses
+  for (int i = 0; i < frames; i++){
+   key = (key ^ (uint64_t)(uintptr_t)trace[i]) * 1099511628211ULL;
+  }
+  key = key ? key : 1;
+  rt_check_total.fetch_add(1, std::memory_order_relaxed);
+  bool placed = false;
+  for (int probe = 0; probe < rt_check_sites; probe++){
+   rt_check_site &site = rt_check_table[(key + probe) % rt_check_sites];
+   uint64_t found = site.key.load(std::memory_order_acquire);
+   if((found == 0) && site.key.compare_exchange_strong(found, key, std::memory_order_acq_rel)){ //a new call site - this thread fills it in
+    site.call = call;
+    site.frames = frames;
+    memcpy(site.trace, trace, sizeof(void*) * frames);
+    site.ready.store(true, std::memory_order_release);
+    rt_check_sites_used.fetch_add(1, std::memory_order_relaxed);
+    found = key;
+   }
+   if(found == key){
+    site.count.fetch_add(1, std::memory_order_relaxed);
+    placed = true;
+    break;
+   }
+  }
+  if(!placed){
+   rt_check_overflow.fetch_add(1, std::memory_order_relaxed);
+  }
+  rt_check_busy = false;
+}
+
+//The next definition of a symbol we interpose, looked up once
+static void* rt_check_next(const char *name){
+  void *next = dlsym(RTLD_NEXT, name);
+  if(next == NULL){
+   fprintf(stderr, "rt_check: cannot find %s\n", name);
+   abort();
+  }
+  return next;
+}
+
+template <typename function> static function rt_check_resolve(std::atomic<function> &next, const char *name){
+  function found = next.load(std::memory_order_relaxed);
+  if(found == NULL){
+   found = (function)rt_check_next(name);
+   next.store(found, std::memory_order_relaxed);
+  }
+  return found;
+}
+
+static std::atomic<int (*)(pthread_mutex_t*)> rt_check_next_mutex_lock(NULL);
+static std::atomic<ssize_t (*)(int, const void*, size_t)> rt_check_next_write(NULL);
+static std::atomic<int (*)(const char*, FILE*)> rt_check_next_fputs(NULL);
+static std::atomic<int (*)(const char*)> rt_check_next_puts(NULL);
+static std::atomic<int (*)(int, FILE*)> rt_check_next_putc(NULL);
+static std::atomic<size_t (*)(const void*, size_t, size_t, FILE*)> rt_check_next_fwrite(NULL);
+static std::atomic<int (*)(FILE*)> rt_check_next_fflush(NULL);
+
+/**
+ * Resolve everything up front, before any RT thread runs: dlsym() and the
+ * first backtrace() (which loads the unwinder) allocate and lock.
+ */
+__attribute__((constructor)) static void rt_check_init(void){
+  rt_check_resolve(rt_check_next_mutex_lock, "pthread_mutex_lock");
+  rt_check_resolve(rt_check_next_write, "write");
+  rt_check_resolve(rt_check_next_fputs, "fputs");
+  rt_check_resolve(rt_check_next_puts, "puts");
+  rt_check_resolve(rt_check_next_putc, "putc");
+  rt_check_resolve(rt_check_next_fwrite, "fwrite");
+  rt_check_resolve(rt_check_next_fflush, "fflush");
+  void *trace[2];
+  backtrace(trace, 2);
+}
+
+extern "C" {
+void *malloc(size_t size) __THROW {
+  rt_check_record(rt_check_malloc);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) __THROW {
+  rt_check_record(rt_check_malloc);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW {
+  rt_check_record(rt_check_malloc);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) __THROW {
+  if(ptr){
+   rt_check_record(rt_check_free);
+  }
+  __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) __THROWNL {
+  rt_check_record(rt_check_mutex);
+  return rt_check_resolve(rt_check_next_mutex_lock, "pthread_mutex_lock")(mutex);
+}
+
+ssize_t write(int fd, const void *buffer, size_t count){
+  rt_check_record(rt_check_write);
+  return rt_check_resolve(rt_check_next_write, "write")(fd, buffer, count);
+}
+
+//glibc's stdio writes through its own internal write, so printf and friends are caught at the entry
+int printf(const char *format, ...){
+  rt_check_record(rt_check_stdio);
+  va_list args;
+  va_start(args, format);
+  int result = vprintf(format, args);
+  va_end(args);
+  return result;
+}
+
+int fprintf(FILE *stream, const char *format, ...){
+  rt_check_record(rt_check_stdio);
+  va_list args;
+  va_start(args, format);
+  int result = vfprintf(stream, format, args);
+  va_end(args);
+  return result;
+}
+
+int fputs(const char *text, FILE *stream){
+  rt_check_record(rt_check_stdio);
+  return rt_check_resolve(rt_check_next_fputs, "fputs")(text, stream);
+}
+
+int puts(const char *text){
+  rt_check_record(rt_check_stdio);
+  return rt_check_resolve(rt_check_next_puts, "puts")(text);
+}
+
+int putc(int c, FILE *stream){
+  rt_check_record(rt_check_stdio);
+  return rt_check_resolve(rt_check_next_putc, "putc")(c, stream);
+}
+
+size_t fwrite(const void *buffer, size_t size, size_t count, FILE *stream){
+  rt_check_record(rt_check_stdio);
+  return rt_check_resolve(rt_check_next_fwrite, "fwrite")(buffer, size, count, stream);
+}
+
+int fflush(FILE *stream){
+  rt_check_record(rt_check_stdio);
+  return rt_check_resolve(rt_check_next_fflush, "fflush")(stream);
+}
+}
+
+//Open for the length of a process callback - calls made inside are recorded
+struct rt_check_scope {
+ rt_check_scope(void){ rt_check_open++; }
+ ~rt_check_scope(void){ rt_check_open--; }
+};
+
+static const bool rt_check_enabled = true;
+
+static uint64_t rt_check_violations(void){
+  return rt_check_total.load(std::memory_order_relaxed);
+}
+
+//Grows only when a call site not seen before is recorded
+static int rt_check_call_sites(void){
+  return rt_check_sites_used.load(std::memory_order_relaxed);
+}
+
+//Every call site recorded so far, with its count and backtrace, as JSON
+static std::string rt_check_report(void){
+  static const char *names[] = { "malloc", "free", "pthread_mutex_lock", "write", "stdio" };
+  std::string sites;
+  for (int i = 0; i < rt_check_sites; i++){
+   rt_check_site &site = rt_check_table[i];
+   if(!site.ready.load(std::memory_order_acquire)){
+    continue;
+   }
+   std::string trace;
+   char **symbols = backtrace_symbols(site.trace, site.frames);
+   for (int frame = 0; frame < site.frames; frame++){
+    std::string symbol = symbols ? symbols[frame] : "?";
+    std::string escaped;
+    for (char c : symbol){
+     if((c == '"') || (c == '\\')){
+      escaped += '\\';
+     }
+     escaped += c;
+    }
+    trace += std::string(trace.empty() ? "" : ",")+"\""+escaped+"\"";
+   }
+   free(symbols);
+   sites += std::string(sites.empty() ? "" : ",")+"{\"call\":\""+names[site.call]+"\",\"count\":"+std::to_string(site.count.load())+",\"backtrace\":["+trace+"]}";
+  }
+  return "{\"enabled\":true,\"violations\":"+std::to_string(rt_check_violations())+",\"untracked\":"+std::to_string(rt_check_overflow.load())+",\"sites\":["+sites+"]}";
+}
+
+#else
+
+struct rt_check_scope {
+ rt_check_scope(void){}
+};
+
+static const bool rt_check_enabled = false;
+
+static inline uint64_t rt_check_violations(void){
+  return 0;
+}
+
+static inline int rt_check_call_sites(void){
+  return 0;
+}
+
+static inline std::string rt_check_report(void){
+  return "{\"enabled\":false}";
+}
+
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Memory locking, denormal handling and thread placement for the audio path
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef RT_SETUP_H
+#define RT_SETUP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "trace.h"
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+static const size_t rt_stack_prefault = 64 * 1024; //stack the RT threads touch up front - far more than a process callback uses
+
+/**
+ * Flush denormal results and inputs to zero in the calling thread. Filter
+ * and gain ramp tails decay into denormals on silence, which are many
+ * times slower than normal floats on every CPU we run on.
+ */
+static inline void rt_flush_denormals(void){
+#if defined(__SSE__) || defined(__x86_64__)
+  _mm_setcsr(_mm_getcsr() | 0x8040); //FTZ (bit 15) and DAZ (bit 6)
+#elif defined(__aarch64__)
+  uint64_t fpcr;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1 << 24))); //FZ - flushes inputs and results
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+  uint32_t fpscr;
+  __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+  __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1 << 24))); //FZ for VFP - NEON always flushes
+#endif
+}
+
+//Touch the stack the calling thread will use so its pages are faulted in (and locked) now
+static inline void rt_prefault_stack(void){
+  volatile char stack[rt_stack_prefault];
+  for (size_t i = 0; i < sizeof(stack); i += 4096){
+   stack[i] = 0;
+  }
+}
+
+//Touch a buffer the RT thread will use, for memory that is allocated but not yet written
+static inline void rt_prefault(void *buffer, size_t bytes){
+  if(buffer){
+   memset(buffer, 0, bytes);
+  }
+}
+
+/**
+ * JACK thread init callback: called in the client's RT thread before the
+ * first cycle, so the process callback starts with denormals flushed, its
+ * stack resident and its trace ring claimed.
+ */
+static inline void rt_thread_init(void *arg){
+  rt_flush_denormals();
+  rt_prefault_stack();
+  trace_thread();
+}
+
+//CPUs and priority for one kind of thread
+struct rt_thread_role {
+  std::vector<int> cpus; //empty leaves the affinity alone
+  int priority = -1; //SCHED_FIFO priority, 0 for SCHED_OTHER, -1 leaves the scheduling alone
+};
+
+/**
+ * Memory locking and per role thread placement. Roles are set from a spec
+ * like "control=0;ndi=1-2@0;sender=2,3@70": each role gets the listed
+ * CPUs and optionally a priority. Threads apply their role when they start;
+ * threads the NDI SDK creates inherit the role of the thread that created
+ * the NDI instance, see rt_thread_scope.
+ */
+struct rt_setup {
+ public:
+  //Parse the spec, accepting only the roles listed. Returns false on a malformed spec
+  bool parse(const std::string &spec, const std::vector<std::string> &roles){
+   size_t start = 0;
+   while (start < spec.size()){
+    size_t end = spec.find(';', start);
+    if(end == std::string::npos){
+     end = spec.size();
+    }
+    std::string entry = spec.substr(start, end - start);
+    start = end + 1;
+    if(entry.empty()){
+     continue;
+    }
+    size_t equals = entry.find('=');
+    std::string role = entry.substr(0, (equals == std::string::npos) ? entry.size() : equals);
+    bool known = false;
+    for (const std::string &name : roles){
+     known = known || (name == role);
+    }
+    if(!known || (equals == std::string::npos)){
+     fprintf(stderr, "unknown thread role in %s\n", entry.c_str());
+     return false;
+    }
+    std::string cpus = entry.substr(equals + 1);
+    rt_thread_role &config = m_roles[role];
+    size_t at = cpus.find('@');
+    if(at != std::string::npos){
+     config.priority = atoi(cpus.c_str() + at + 1);
+     cpus = cpus.substr(0, at);
+    }
+    if(!parse_cpus(cpus, config.cpus)){
+     fprintf(stderr, "bad CPU list in %s\n", entry.c_str());
+     return false;
+    }
+   }
+   return true;
+  }
+
+  bool has(const char *role){ return m_roles.find(role) != m_roles.end(); }
+
+  //Move the calling thread to its role's CPUs and priority
+  void apply(const char *role){
+   auto found = m_roles.find(role);
+   if(found == m_roles.end()){
+    return;
+   }
+   const rt_thread_role &config = found->second;
+   if(!config.cpus.empty()){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : config.cpus){
+     CPU_SET(cpu, &set);
+    }
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(result != 0){
+     fprintf(stderr, "cannot set %s thread affinity: %s\n", role, strerror(result));
+    }
+   }
+   if(config.priority >= 0){
+    struct sched_param param;
+    param.sched_priority = config.priority;
+    int result = pthread_setschedparam(pthread_self(), (config.priority > 0) ? SCHED_FIFO : SCHED_OTHER, &param);
+    if(result != 0){
+     fprintf(stderr, "cannot set %s thread priority %d: %s\n", role, config.priority, strerror(result));
+    }
+   }
+  }
+
+  /**
+   * Lock the process memory so nothing the audio path uses can be paged
+   * out. Pages are locked as they are first touched where the kernel
+   * allows it, so the many thread stacks are not pulled in whole; buffers
+   * and RT stacks are prefaulted where they are set up instead. Freed heap
+   * memory is kept mapped so it stays locked for the next allocation.
+   */
+  void lock_memory(void){
+   int result = -1;
+#ifdef MCL_ONFAULT
+   result = mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT);
+#endif
+   if(result != 0){ //older kernels lock and fault in everything
+    result = mlockall(MCL_CURRENT | MCL_FUTURE);
+   }
+   if(result != 0){
+    fprintf(stderr, "cannot lock memory (%s) - page faults can reach the audio path\n", strerror(errno));
+    return;
+   }
+   mallopt(M_TRIM_THRESHOLD, -1);
+   mallopt(M_MMAP_MAX, 0);
+  }
+
+ private:
+  std::map<std::string, rt_thread_role> m_roles;
+
+  static bool parse_cpus(const std::string &list, std::vector<int> &cpus){
+   size_t start = 0;
+   while (start < list.size()){
+    size_t end = list.find(',', start);
+    if(end == std::string::npos){
+     end = list.size();
+    }
+    std::string range = list.substr(start, end - start);
+    start = end + 1;
+    if(range.empty() || (range.find_first_not_of("0123456789-") != std::string::npos)){
+     return false;
+    }
+    size_t dash = range.find('-');
+    int first = atoi(range.c_str());
+    int last = (dash == std::string::npos) ? first : atoi(range.c_str() + dash + 1);
+    if((last < first) || (last >= CPU_SETSIZE)){
+     return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++){
+     cpus.push_back(cpu);
+    }
+   }
+   return true;
+  }
+};
+
+/**
+ * Apply a role to the calling thread for the life of the scope and put its
+ * own placement back afterwards. Wraps the creation of NDI instances so the
+ * threads the SDK starts for them inherit the role.
+ */
+struct rt_thread_scope {
+ rt_thread_scope(rt_setup &setup, const char *role): m_active(setup.has(role)){
+  if(!m_active){
+   return;
+  }
+  pthread_getaffinity_np(pthread_self(), sizeof(m_cpus), &m_cpus);
+  pthread_getschedparam(pthread_self(), &m_policy, &m_param);
+  setup.apply(role);
+ }
+ ~rt_thread_scope(void){
+  if(m_active){
+   pthread_setaffinity_np(pthread_self(), sizeof(m_cpus), &m_cpus);
+   pthread_setschedparam(pthread_self(), m_policy, &m_param);
+  }
+ }
+ private:
+  bool m_active;
+  cpu_set_t m_cpus;
+  int m_policy = SCHED_OTHER;
+  struct sched_param m_param;
+};
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Single producer, single consumer lock-free queue
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * Fixed size ring buffer for handing items from one thread to another
+ * without locks or allocation, e.g. from the web server thread to a JACK
+ * process callback. push() and pop() never block; push() returns false
+ * when the queue is full and pop() returns false when it is empty.
+ */
+template <typename T, size_t N>
+struct spsc_queue {
+  static_assert((N & (N - 1)) == 0, "spsc_queue size must be a power of two");
+ spsc_queue(void): m_head(0), m_tail(0){}
+ public:
+  bool push(const T &item){ //producer thread only
+   size_t head = m_head.load(std::memory_order_relaxed);
+   size_t next = (head + 1) & (N - 1);
+   if(next == m_tail.load(std::memory_order_acquire)){ //full
+    return false;
+   }
+   m_items[head] = item;
+   m_head.store(next, std::memory_order_release);
+   return true;
+  }
+
+  bool full(void){ //producer thread only - a push after false cannot fail
+   return ((m_head.load(std::memory_order_relaxed) + 1) & (N - 1)) == m_tail.load(std::memory_order_acquire);
+  }
+
+  bool pop(T &item){ //consumer thread only
+   size_t tail = m_tail.load(std::memory_order_relaxed);
+   if(tail == m_head.load(std::memory_order_acquire)){ //empty
+    return false;
+   }
+   item = m_items[tail];
+   m_tail.store((tail + 1) & (N - 1), std::memory_order_release);
+   return true;
+  }
+ private:
+  T m_items[N];
+  char m_pad0[64]; //keep the two indices on separate cache lines (alignas would need C++17 aligned new)
+  std::atomic<size_t> m_head; //next slot the producer writes
+  char m_pad1[64];
+  std::atomic<size_t> m_tail; //next slot the consumer reads
+};
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Per thread event recorder with Chrome trace-event JSON export
+ *
+ * This program can be used and distrubuted without resrictions
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+enum trace_detail {
+  trace_off = 0,
+  trace_coarse, //a few events per cycle and per control action - cheap enough to leave on
+  trace_fine    //adds queue traffic, several events per cycle per stream
+};
+
+static const int trace_threads = 64; //threads that get a ring - later ones are not recorded
+static const size_t trace_ring_events = 16384; //per thread, a power of two - seconds of coarse events at small periods
+
+struct trace_event {
+  uint64_t ns; //CLOCK_MONOTONIC
+  const char *name; //a string literal, so recording never copies
+  char phase; //'B'egin, 'E'nd or 'i'nstant as in the trace-event format
+};
+
+/**
+ * One thread's events. Only the owning thread writes, so recording is a
+ * store and an index bump with no locks or atomics read-modify-write; a
+ * dump copies the ring and drops whatever was overwritten while it copied.
+ */
+struct trace_ring {
+  std::atomic<uint64_t> head; //events recorded since the thread started
+  std::atomic<bool> ready; //tid and name are filled in
+  int tid;
+  char thread_name[16];
+  trace_event events[trace_ring_events];
+};
+
+static std::atomic<int> trace_level(trace_coarse);
+static trace_ring trace_rings[trace_threads];
+static std::atomic<int> trace_rings_used(0);
+static std::atomic<bool> trace_dump_requested(false); //set from the signal handler
+static __thread trace_ring *trace_local = NULL;
+static __thread bool trace_claimed = false;
+
+static inline uint64_t trace_now(void){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now); //vDSO, no system call
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * The calling thread's ring, claimed on first use. The claim touches the
+ * whole ring, so RT threads claim theirs from the JACK thread init
+ * callback rather than in their first cycle.
+ */
+static inline trace_ring* trace_thread(void){
+  if(!trace_claimed){
+   trace_claimed = true;
+   int index = trace_rings_used.fetch_add(1);
+   if(index < trace_threads){
+    trace_ring *ring = &trace_rings[index];
+    memset(ring->events, 0, sizeof(ring->events));
+    ring->tid = (int)syscall(SYS_gettid);
+    prctl(PR_GET_NAME, ring->thread_name, 0, 0, 0);
+    ring->thread_name[sizeof(ring->thread_name) - 1] = 0;
+    ring->ready.store(true, std::memory_order_release);
+    trace_local = ring;
+   }
+  }
+  return trace_local;
+}
+
+static inline void trace_record(const char *name, char phase){
+  trace_ring *ring = trace_thread();
+  if(ring == NULL){
+   return;
+  }
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  trace_event &event = ring->events[head & (trace_ring_events - 1)];
+  event.ns = trace_now();
+  event.name = name;
+  event.phase = phase;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+//Record a begin event now and the matching end when the scope closes, if detail is being traced
+struct trace_scope {
+ trace_scope(int detail, const char *name): m_name((detail <= trace_level.load(std::memory_order_relaxed)) ? name : NULL){
+  if(m_name){
+   trace_record(m_name, 'B');
+  }
+ }
+ ~trace_scope(void){
+  if(m_name){
+   trace_record(m_name, 'E');
+  }
+ }
+ private:
+  const char *m_name;
+};
+
+//A single point in time, e.g. a dropped frame
+static inline void trace_mark(int detail, const char *name){
+  if(detail <= trace_level.load(std::memory_order_relaxed)){
+   trace_record(name, 'i');
+  }
+}
+
+static inline bool trace_parse_level(const char *text){
+  static const char *names[] = { "off", "coarse", "fine" };
+  for (int level = trace_off; level <= trace_fine; level++){
+   if(strcmp(text, names[level]) == 0){
+    trace_level = level;
+    return true;
+   }
+  }
+  return false;
+}
+
+/**
+ * Every thread's events in the Chrome trace-event format, for
+ * chrome://tracing or ui.perfetto.dev. Events whose begin was overwritten
+ * in the ring are left out so the nesting stays valid.
+ */
+static std::string trace_json(void){
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  std::string pid = std::to_string(getpid());
+  bool first = true;
+  int used = std::min(trace_rings_used.load(), trace_threads);
+  std::vector<trace_event> events(trace_ring_events);
+  char line[256];
+  for (int index = 0; index < used; index++){
+   trace_ring &ring = trace_rings[index];
+   if(!ring.ready.load(std::memory_order_acquire)){ //still being claimed
+    continue;
+   }
+   uint64_t head = ring.head.load(std::memory_order_acquire);
+   uint64_t start = (head > trace_ring_events) ? head - trace_ring_events : 0;
+   for (uint64_t n = start; n < head; n++){
+    events[n - start] = ring.events[n & (trace_ring_events - 1)];
+   }
+   uint64_t after = ring.head.load(std::memory_order_acquire);
+   uint64_t valid = (after > trace_ring_events) ? after - trace_ring_events : 0; //older than this was written over during the copy
+   snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%s,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",", pid.c_str(), ring.tid, ring.thread_name);
+   json += line;
+   first = false;
+   int depth = 0;
+   for (uint64_t n = std::max(start, valid); n < head; n++){
+    const trace_event &event = events[n - start];
+    if(event.name == NULL){
+     continue;
+    }
+    if(event.phase == 'E'){
+     if(depth == 0){ //its begin is gone
+      continue;
+     }
+     depth--;
+    }else if(event.phase == 'B'){
+     depth++;
+    }
+    snprintf(line, sizeof(line), ",{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%s,\"tid\":%d%s}", event.name, event.phase, event.ns / 1000.0, pid.c_str(), ring.tid,
+             (event.phase == 'i') ? ",\"s\":\"t\"" : "");
+    json += line;
+   }
+  }
+  return json + "]}";
+}
+
+static void trace_signal_handler(int){
+  trace_dump_requested = true;
+}
+
+//Dump on SIGUSR1: the handler only sets a flag, trace_poll_signal() writes the file
+static inline void trace_install_signal(void){
+  signal(SIGUSR1, trace_signal_handler);
+}
+
+//Call from a control thread's loop: writes /tmp/<program>-trace-<pid>.json if a dump was asked for
+static inline void trace_poll_signal(const char *program){
+  if(!trace_dump_requested.exchange(false)){
+   return;
+  }
+  std::string path = "/tmp/" + std::string(program) + "-trace-" + std::to_string(getpid()) + ".json";
+  FILE *file = fopen(path.c_str(), "w");
+  if(file == NULL){
+   fprintf(stderr, "cannot write trace to %s\n", path.c_str());
+   return;
+  }
+  std::string json = trace_json();
+  fwrite(json.data(), 1, json.size(), file);
+  fclose(file);
+  printf("Trace written to %s\n", path.c_str());
+}
+
+#endif